@@ -54,7 +54,18 @@ class camera {
 		*	returns the corresponding ray to cast out into the world
 		*/
         ray get_ray(double s, double t) const {
-            vec3 rd = lens_radius * random_in_unit_disk();
+            return get_ray(s, t, random_double(), random_double());
+        }
+
+		/* Gets the ray given s and t column-row coordinates and the point
+		*	of the lens it passes through
+		*	@s: the horizontal coordinate
+		*	@t: the vertical coordinate
+		*	@lens_u1, @lens_u2: uniform numbers that pick the point on the lens
+		*	returns the corresponding ray to cast out into the world
+		*/
+        ray get_ray(double s, double t, real lens_u1, real lens_u2) const {
+            vec3 rd = lens_radius * sample_disk(lens_u1, lens_u2);
             vec3 offset = u * rd.x() + v * rd.y();
             return ray(
                 origin + offset,
@@ -94,6 +105,11 @@ class cameraDefault {
             return ray(origin, lower_left_corner + u*horizontal + v*vertical - origin);
         }
 
+		// A pinhole: the lens numbers are not used.
+        ray get_ray(double u, double v, real, real) const {
+            return get_ray(u, v);
+        }
+
     private:
         vec3 origin;
         vec3 lower_left_corner;
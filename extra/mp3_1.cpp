@@ -22,6 +22,7 @@
 #include "util/TriMesh.h"
 #include "util/light.h"
 #include "util/material.h"
+#include "util/sampler.h"
 #include <chrono> 
 
 using namespace std::chrono; 
@@ -95,15 +96,6 @@ using std::string;
 * the point lies outside the triangle.
 */
 
-struct interval {
-	double min;
-	double max;
-	bool closed;
-};
-
-// interval vector
-vector<interval> intervals; 
-
 // Phong reflection
 //vec3 lightPos = vec3(1,1,1);
 vec3 la = vec3(0.8,0.2,0.9);
@@ -113,12 +105,8 @@ float shininess = 1;	// shininess coefficient;
 const vec3 eyepoint = vec3(1,1,400); // perspective projection
 double gam = 1.0; // 1.7
 
-// Mesh variables
-static TriMesh mesh;
-bool meshExists = false;
-int v1index = 0;
-int v2index = 0;
-int v3index = 0;
+// Materials of the scene, primitives refer to them by index
+material_table materials;
 
 /*	Computes m^exp
 *	@m: base
@@ -185,63 +173,8 @@ vec3 clamp(vec3 color) {
 *	returns a vec3 color of the pixel shaded using phong shading
 */
 vec3 phong(vec3 hitpoint,vec3 n, vec3 kd, vec3 ld, vec3 ks, vec3 ls, vec3 lightPos) {
-	vec3 N;
-	if (meshExists) {
-		vec3 n1 = mesh.normals[v1index-1];
-		vec3 n2 = mesh.normals[v2index-1];
-		vec3 n3 = mesh.normals[v3index-1];
-
-		/*n1 = uniformScale(n1, 50);
-		n2 = uniformScale(n2, 50);
-		n3 = uniformScale(n2, 50);*/
-
-		/*n1 = rotateAboutPoint(n1, -90, 1);
-		n2 = rotateAboutPoint(n2, -90, 1);
-		n3 = rotateAboutPoint(n3, -90, 1);*/
-		
-		/*n1 = normalize(n1);
-		n2 = normalize(n2);
-		n3 = normalize(n3);*/
-
-		vec3 v1 = mesh.vertices[v1index-1];
-		vec3 v2 = mesh.vertices[v2index-1];
-		vec3 v3 = mesh.vertices[v3index-1];
-
-		// Apply affine transformation to vertices
-		/*v1 *= 200;
-		v2 *= 200;
-		v3 *= 200;*/
-		v1 = uniformScale(v1, 50);
-		v2 = uniformScale(v2, 50);
-		v3 = uniformScale(v3, 50);
-		/*v1 = rotateAboutPoint(v1, 90, 1);
-		v2 = rotateAboutPoint(v2, 90, 1);
-		v3 = rotateAboutPoint(v3, 90, 1);*/
-	
-		double Cx = (v1[0] + v2[0] + v3[0])/3;
-		double Cy = (v1[1] + v2[1] + v3[1])/3;
-
-	
-		double px = hitpoint[0];
-		double py = hitpoint[1];
-		double pz = hitpoint[2];
-		double x1 = v1[0];
-		double x2 = v2[0];
-		double x3 = v3[0];
-		double y1 = v1[1];
-		double y2 = v2[1];
-		double y3 = v3[1];
-		double b1,b2,b3 = 0.0;
-		double denom = (((y1-y3)*(x2-x3)) + ((y2-y3)*(x3-x1))) + 1e-5;
-		b1 = (((py-y3)*(x2-x3)) + ((y2-y3)*(x3-px)))/denom;
-		b2 = (((py-y1)*(x3-x1)) + ((y3-y1)*(x1-px)))/denom;
-		b3 = 1 - b2 - b1;
-
-		N = b1*n1 + b2*n2 + b3*n3;
-		N = normalize(N);
-	} else {
-		N = normalize(n);
-	}
+	// Mesh hits already carry the interpolated vertex normal.
+	vec3 N = normalize(n);
 	vec3 L = normalize(lightPos - hitpoint);	// clamp L and N maybe?
 	vec3 V = normalize(eyepoint - hitpoint);
 	vec3 X = normalize(hitpoint - lightPos);
@@ -265,89 +198,6 @@ vec3 CalculatePhong(vec3 hitpoint,vec3 n, vec3 kd, vec3 ks) {
 	return clamp((ka*la) + color);
 }
 
-/* Generates a list of intervals based on n and s
-*	@n: A perfect square, the number of intervals
-*	@s: pixel extent
-*	returns a list of intervals from [si/n,s(i+1)/n]
-*/
-void generateIntervals(int n, int s) {
-	// n must be a perfect square
-	// coarse grid is sqrt(n)*sqrt(n)
-	// fine grid is n*n
-	int course_grid_size = sqrt(n) * sqrt(n);
-	int fine_grid_size = n * n;
-	for (int i = 0; i < n; i++) {
-		interval in;
-		double g = double(i)/double(n);
-		double h = double((i+1))/double(n);
-		in.min = s*g + 1e-6;
-		in.max = s*h;
-		in.closed = true;
-		intervals.push_back(in);
-	}
-}
-
-/* Determines if an int is in a vector of ints
-*	@n: element to search for
-*	@list: vector of ints
-*	returns true if element is in list, false otherwise.
-*/
-bool contains(int n, vector<int>& list) {
-	if (list.size() == 0) return false;
-	for (int i = 0; i < list.size(); i++) {
-		if (n == list[i]) return true;
-	}
-	return false;
-}
-
-
-/*	Gets the dx and dy used for jittering
-*	@intervals: the list of intervals
-*	@n: samples per pixel
-*	returns random dx and dy values based on multi-jittered sampling
-*/
-vector<vec3> getdxdy(int n) {
-	double dx = 0;
-	double dy = 0;
-	int ysize = n;
-	vector<vec3> vecs;
-	vector<int> deleted_fine;
-	int j = 0;
-	int d = 1;
-
-	for (int k = 0; k < int(sqrt(n)); k++) {
-		ysize = n;
-		vector<int> deleted_coarse;
-		for (int i = j; i < (d)*int(sqrt(n)); i++) {
-			interval inx = intervals[i];
-			dx = random_double(inx.min, inx.max);
-			int yi = rand() % ysize;
-			while (contains(yi,deleted_coarse) && contains(yi, deleted_fine)) {
-				yi = rand() % ysize;
-			}
-
-			interval iny = intervals[yi];
-			dy = random_double(iny.min, iny.max);
-			deleted_fine.push_back(yi);
-		
-			int m = yi % int(sqrt(n));
-			int r = int(sqrt(n)) - m;
-			// delete m numbers before and then
-			// sqrt(n) - m intervals after including
-			// current one
-			for (int l = yi-m; l < yi + r; l++) {
-				deleted_coarse.push_back(l);
-			}
-		
-			vecs.push_back(vec3(dx,dy,0));
-		}
-		j += int(sqrt(n));
-		d += 1;
-	}
-
-	return vecs;
-}
-
 /* Casts a ray to determine if it hits any objects in the scene. Uses Phong Shading.
 *	@r: The ray to cast.
 *	@world: The list of hittable objects to test ray intersection with
@@ -355,6 +205,7 @@ vector<vec3> getdxdy(int n) {
 vec3 raycast(ray r, const hittable& world) {
 	hit_record rec;
 	if (world.hit(r,0,infinity,rec)) {
+		rec.obj->get_surface(r, rec);
 		// Shadows
 		// create a ray from hitpoint to all light sources
 		vec3 hitpoint = rec.p;
@@ -369,12 +220,7 @@ vec3 raycast(ray r, const hittable& world) {
 				return vec3(0,0,0);
 			}
 		}
-		if (meshExists) {
-			v1index = rec.v1i;
-			v2index = rec.v2i;
-			v3index = rec.v3i;
-		}
-		return CalculatePhong(rec.p, rec.n, rec.kd, rec.ks);
+		return CalculatePhong(rec.p, rec.n, rec.obj->phong_kd(), rec.obj->phong_ks());
 	}
 
 	vec3 unit_direction = normalize(r.direction());
@@ -395,6 +241,7 @@ vec3 raycastMaterial(const ray& r, const hittable& world, int depth) {
         return vec3(0,0,0);
 
     if (world.hit(r, 0.001, infinity, rec)) {
+		rec.obj->get_surface(r, rec);
 		// Shadows
 		// create a ray from hitpoint to all light sources
 		/*vec3 hitpoint = rec.p;
@@ -412,7 +259,7 @@ vec3 raycastMaterial(const ray& r, const hittable& world, int depth) {
 
         ray scattered;
         vec3 attenuation;	
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+        if (scatter(materials[rec.mat_id], r, rec, attenuation, scattered))
             return attenuation * raycastMaterial(scattered, world, depth-1);
         return vec3(0,0,0);
     }
@@ -451,7 +298,7 @@ vec3 randomColor() {
 }*/
 
 /* The main method to run everything.
-*	compile using: g++ mp1.cpp -std=c++11 -o mp1
+*	compile using: g++ mp1.cpp -std=c++11 -pthread -o mp1 (the obj loader parses on threads)
 *	./mp2 0 400 1.7 > output.ppm
 *	@argc: The size of args array
 *	@args: The arguments provided by the command line
@@ -486,11 +333,12 @@ int main(int argc, char** args) {
 
 
 	// MP3
-	auto material_ground = make_shared<lambertian>(vec3(0.8, 0.8, 0.0));
-    auto material_center = make_shared<lambertian>(vec3(0.7, 0.3, 0.3));
-    auto material_left   = make_shared<metal>(vec3(0.8, 0.8, 0.8));
-    auto material_right  = make_shared<metal>(vec3(0.8, 0.6, 0.2));
-	auto material_glass	 = make_shared<dielectric>(1.23);
+	auto material_ground = materials.add(lambertian(vec3(0.8, 0.8, 0.0)));
+	auto material_glass	 = materials.add(dielectric(1.23));
+	// used by the commented-out scenes below, uncomment them together
+    //auto material_center = materials.add(lambertian(vec3(0.7, 0.3, 0.3)));
+    //auto material_left   = materials.add(metal(vec3(0.8, 0.8, 0.8)));
+    //auto material_right  = materials.add(metal(vec3(0.8, 0.6, 0.2)));
 
 	//world.add(make_shared<triangle>(vec3(50-100,50-100,-10), vec3(0-100,-50-100,-10), vec3(100-100,-50-100,-10), vec3(0.5,0.4,0.8), vec3(1,1,1), material_center));
 
@@ -509,7 +357,7 @@ int main(int argc, char** args) {
     //world.add(make_shared<sphere>(vec3( 1.0,    0.0, 0),   50, vec3(0,0,0), material_right));
 
 	//world.add(make_shared<sphere>(vec3(-50,0,-60),49.99,vec3(0,0,1), material_ground));
-	//world.add(make_shared<plane>(vec3(0,0,-400), vec3(0,0,1), vec3(0.8,0.5,0.8), material_center));	// plane doesnt have any axis aligned bounding box so dont use it in MP2
+	//world.add(make_shared<plane>(vec3(0,0,-400), vec3(0,0,1), vec3(0.8,0.5,0.8), material_center));	// plane has no bounding box, wrap world in a scene (util/scene.h) rather than a bvh_node to use it with a BVH
 	//world.add(make_shared<sphere>(vec3( 0, -300.5, -150), 300.0, vec3(0,0,0), material_ground));
 
 	// Image
@@ -543,13 +391,16 @@ int main(int argc, char** args) {
 	camera cam = camera(aspect_ratio, camera_origin, viewdir, up, d, ortho);
 	//camera cam;
 
-	const int samples_per_pixels = 64;	// 100, must be square of some number
+	const int samples_per_pixels = 64;	// 100
+
+	// Correlated multi-jittered offsets, computed once for every pixel
+	sampler jitter(sampler::cmj, samples_per_pixels);
 
 	// Mesh (MP2)
 	/*char* fileName = "objs/teapot.obj";
-	mesh = TriMesh(fileName, vec3(0.3,0.3,0.8), vec3(1,0,0));
+	TriMesh mesh(fileName, vec3(0.3,0.3,0.8), vec3(1,0,0));
 	mesh.loadFromOBJ();
-	world = mesh.generateTriangles();*/
+	world = mesh.generateTriangles(nullptr, material_center);*/
 
 	// BVH
 	//bvh_node bvh = bvh_node(world, 0, infinity, 10);
@@ -573,12 +424,9 @@ int main(int argc, char** args) {
 			vec3 color = vec3(0,0,0);
 
 			// Anti-Aliasing (Multi-Jittered Sampling)
-			generateIntervals(samples_per_pixels,s);
-			vector<vec3> vecs = getdxdy(samples_per_pixels);
 			for (int k = 0; k < samples_per_pixels; k++) {
-				vec3 dxdy = vecs[k];
-				dx = dxdy.x();
-				dy = dxdy.y();
+				dx = s * jitter.get(j * image_width + i, k, SAMPLE_PIXEL);
+				dy = s * jitter.get(j * image_width + i, k, SAMPLE_PIXEL + 1);
 				double x = s*(double(i) - (image_width/2) + dx);
 				double y = s*(double(j) - (image_height/2) + dy);
 				ray r = cam.get_ray(x,y);
@@ -3,20 +3,30 @@
 
 #include "../util/hittable.h"
 #include "../util/vec3.h"
+#include "../util/onb.h"
 
 class sphere : public hittable {
     public:
         sphere() {}
-        sphere(vec3 cen, double r, shared_ptr<material> maty) : center(cen), radius(r), mat(maty) {};
+        sphere(vec3 cen, real r, int maty) : center(cen), radius(r), mat(maty) {};
 
         virtual bool hit(
-            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+            const ray& r, real t_min, real t_max, hit_record& rec) const override;
 		virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+		virtual void hit_packet(
+			const ray_packet& p, real t_min, packet_hits& hits, lane_mask active) const override;
+		virtual void get_surface(const ray& r, hit_record& rec) const override;
+		virtual vec3 sample(const vec3& o, real u1, real u2, real& pdf) const override;
+		virtual real pdf(const vec3& o, const vec3& dir) const override;
+		virtual real area() const override { return 4 * pi * radius * radius; }
 
     public:
         vec3 center;
-        double radius;
-		shared_ptr<material> mat;
+        real radius;
+		int mat;
+
+	private:
+		void fill_record(real root, hit_record& rec) const;
 };
 
 /*	Determines whether ray hits sphere
@@ -26,7 +36,7 @@ class sphere : public hittable {
 *	@rec: the hit record struct
 *	returns true if sphere intersects ray
 */
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     vec3 oc = r.origin() - center;
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -44,14 +54,105 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
             return false;
     }
 
+    fill_record(root, rec);
+    return true;
+}
+
+/*	Intersects every lane of a ray packet with the sphere. The quadratic is
+*	solved for all lanes in one branch-free loop that gcc vectorizes from
+*	-O2 on with -fno-math-errno (see aabb::hit_packet for the lane widths);
+*	only the lanes that hit closer than their current t_max get their hit
+*	record filled in afterwards.
+*	@p: ray packet to cast
+*	@t_min: the min t value
+*	@hits: per-lane hit records
+*	@active: the lanes to test
+*/
+void sphere::hit_packet(const ray_packet& p, real t_min, packet_hits& hits, lane_mask active) const {
+	const real cx = center[0], cy = center[1], cz = center[2];
+	const real r2 = radius*radius;
+	real roots[PACKET_SIZE];
+	real found[PACKET_SIZE];
+	for (int i = 0; i < PACKET_SIZE; i++) {
+		real lane_max = hits.t_max[i];
+		real ocx = p.ox[i] - cx;
+		real ocy = p.oy[i] - cy;
+		real ocz = p.oz[i] - cz;
+		real a = p.dx[i]*p.dx[i] + p.dy[i]*p.dy[i] + p.dz[i]*p.dz[i];
+		real inv_a = 1 / a;
+		real half_b = ocx*p.dx[i] + ocy*p.dy[i] + ocz*p.dz[i];
+		real c = ocx*ocx + ocy*ocy + ocz*ocz - r2;
+		real discriminant = half_b*half_b - a*c;
+		real sqrtd = std::sqrt(std::max(discriminant, real(0)));
+		// Take the far root only if the near one is behind t_min; if the
+		// near one is past t_max the far one is too.
+		real near = (-half_b - sqrtd) * inv_a;
+		real root = (-half_b + (near >= t_min ? -sqrtd : sqrtd)) * inv_a;
+		roots[i] = root;
+		found[i] = (discriminant >= 0) & (root >= t_min) & (root <= lane_max) ? 1 : 0;
+	}
+
+	for (int i = 0; i < PACKET_SIZE; i++) {
+		if (!(active >> i & 1) || found[i] == 0) continue;
+		fill_record(roots[i], hits.rec[i]);
+		hits.t_max[i] = roots[i];
+		hits.hit |= lane_mask(1) << i;
+	}
+}
+
+/*	Records a candidate hit at root. Only t and the sphere are stored;
+*	the surface is expanded by get_surface if this hit turns out closest.
+*	@root: t value of the hit
+*	@rec: the hit record struct
+*/
+void sphere::fill_record(real root, hit_record& rec) const {
     rec.t = root;
-    rec.p = r.at(rec.t);
-    rec.n = (rec.p - center) / radius;
-	rec.mat_ptr = mat;
+	rec.obj = this;
+	rec.prim_id = 0;
+	rec.mat_id = mat;
+}
 
+/*	Computes the hit point and normal of the closest hit.
+*	@r: the ray that hit the sphere
+*	@rec: the hit record struct
+*/
+void sphere::get_surface(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
 	vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
-    return true;
+}
+
+/*	Picks a direction uniformly inside the cone of directions under which
+*	the sphere is seen from o, so every sample hits the sphere and the
+*	density is 1 / (solid angle of the cone). Nothing is sampled from
+*	inside the sphere.
+*	@o: the point being lit
+*	@u1, @u2: uniform numbers that choose the direction
+*	@pdf: receives the density per solid angle
+*	returns a direction from o towards the sphere
+*/
+vec3 sphere::sample(const vec3& o, real u1, real u2, real& pdf) const {
+	vec3 axis = center - o;
+	real dist_squared = axis.length_squared();
+	if (dist_squared <= radius*radius) {
+		pdf = 0;
+		return axis;
+	}
+	// 1 - cos_max without the cancellation for small, distant spheres
+	real sin2_max = radius*radius / dist_squared;
+	real one_minus_cos = sin2_max / (1 + std::sqrt(1 - sin2_max));
+	pdf = cone_pdf(one_minus_cos);
+	return onb(axis / std::sqrt(dist_squared)).local(sample_cone(u1, u2, one_minus_cos));
+}
+
+real sphere::pdf(const vec3& o, const vec3& dir) const {
+	hit_record rec;
+	vec3 axis = center - o;
+	real dist_squared = axis.length_squared();
+	if (dist_squared <= radius*radius || !hit(ray(o, dir), 0.001, infinity, rec))
+		return 0;
+	real sin2_max = radius*radius / dist_squared;
+	return cone_pdf(sin2_max / (1 + std::sqrt(1 - sin2_max)));
 }
 
 /*	Constructs a bounding box for a sphere.
@@ -15,6 +15,14 @@
 #include "util/util.h"
 #include "util/material.h"
 #include "util/aarect.h"
+#include "util/bvh.h"
+#include "util/scene.h"
+#include "util/wavefront.h"
+#include "util/sphere_set.h"
+#include "util/image_writer.h"
+#include "util/light_list.h"
+#include "util/sampler.h"
+#include "util/denoise.h"
 
 #include "extra/camera.h"
 #include "extra/sphere.h"
@@ -26,33 +34,9 @@ using namespace std;
 using std::string;
 
 float gam = 2.0;
+const char* hdr_path = "output.pfm";	// linear float32 copy of the image
 unsigned long num_rays = 0;
 
-/* Writes the color to the output stream
-*	@out: The output stream to write the color to
-*	@pixel_color: The color to write
-*	@samples_per_pixel: samples per pixel
-*/
-void write_color(std::ostream &out, vec3 pixel_color, int samples_per_pixel) {
-    // Write the translated [0,255] value of each color component.
-	auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
-
-    // Divide the color by the number of samples.
-    auto scale = 1.0 / samples_per_pixel;
-    r *= scale;
-    g *= scale;
-    b *= scale;
-	r = pow(r,1.0/gam);
-	g = pow(g,1.0/gam);
-	b = pow(b,1.0/gam);
-
-    out << static_cast<int>(255.999 * r) << ' '
-        << static_cast<int>(255.999 * g) << ' '
-        << static_cast<int>(255.999 * b) << '\n';
-}
-
 /* Clamps the value of components of color.
 *	to the interval [0,1]
 *	@color: The vec3 to clamp
@@ -92,7 +76,25 @@ vec3 clamp(vec3 color) {
     auto t = 0.5*(unit_direction.y() + 1.0);
     return (1.0-t)*vec3(1.0, 1.0, 1.0) + t*vec3(0.5, 0.7, 1.0);
 }*/
-vec3 ray_color(const ray& r, const vec3& background, const hittable& world, int depth) {
+vec3 shade(const ray& r, const hit_record& rec, const vec3& background, const hittable& world,
+		   const material_table& materials, const light_list& lights, sample_stream& samples,
+		   int depth, real scattered_pdf, pixel_features* seen);
+
+/* Casts a ray and returns the light it brings back.
+*	@r: The ray to cast.
+*	@world: The list of hittable objects to test ray intersection with
+*	@materials: The scene's material table
+*	@lights: The lights sampled at diffuse hits, may be empty
+*	@samples: The sample's numbers for the bounces
+*	@depth: The max amount of depth of recursion
+*	@scattered_pdf: The density with which r was scattered from a diffuse
+*	hit, 0 for camera rays and specular bounces
+*	@seen: If not null, the denoiser features of the path, still to be
+*	completed by this ray
+*/
+vec3 ray_color(const ray& r, const vec3& background, const hittable& world,
+			   const material_table& materials, const light_list& lights, sample_stream& samples,
+			   int depth, real scattered_pdf = 0, pixel_features* seen = nullptr) {
 	// we have just cast a new ray
 	num_rays += 1;
     hit_record rec;
@@ -102,43 +104,234 @@ vec3 ray_color(const ray& r, const vec3& background, const hittable& world, int
         return vec3(0,0,0);
 
     // If the ray hits nothing, return the background color.
-    if (!world.hit(r, 0.001, infinity, rec))
+    if (!world.hit(r, 0.001, infinity, rec)) {
+		if (seen)
+			record_miss(*seen);
         return background;
+	}
+	rec.obj->get_surface(r, rec);
 
-    ray scattered;
-    vec3 attenuation;
-    vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+    return shade(r, rec, background, world, materials, lights, samples, depth, scattered_pdf, seen);
+}
+
+/* Next-event estimation at a diffuse hit: samples a point on one of the
+*	lights and casts a shadow ray to it. The result is weighted against the
+*	scattered ray, which may reach the same light, with the power heuristic.
+*	@rec: The hit record of a lambertian hit.
+*	@albedo: The albedo at the hit.
+*	@world: The list of hittable objects to test ray intersection with
+*	@materials: The scene's material table
+*	@lights: The lights to sample
+*	@samples: The numbers of the current bounce
+*	returns the light reaching the hit directly, times the BRDF and cosine
+*/
+vec3 direct_light(const hit_record& rec, const vec3& albedo, const hittable& world,
+				  const material_table& materials, const light_list& lights, const sample_stream& samples) {
+	vec3 dir;
+	real light_pdf;
+	const hittable* light = lights.sample(rec.p, samples.get(BOUNCE_LIGHT), samples.get(BOUNCE_LIGHT_POINT),
+										  samples.get(BOUNCE_LIGHT_POINT + 1), dir, light_pdf);
+	if (!light)
+		return vec3(0,0,0);
+	vec3 wi = normalize(dir);
+	real bsdf_pdf = dot(rec.n, wi) / pi;
+	if (bsdf_pdf <= 0)
+		return vec3(0,0,0);
 
-    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-        return emitted;
+	num_rays += 1;
+	ray shadow(offset_ray_origin(rec.p, rec.n, wi), wi);
+	hit_record srec;
+	if (!world.hit(shadow, 0.001, infinity, srec) || srec.obj != light)
+		return vec3(0,0,0);
+	srec.obj->get_surface(shadow, srec);
+	vec3 radiance = emitted(materials[srec.mat_id], srec.u, srec.v, srec.p);
+	// albedo / pi is the BRDF, so BRDF * cos is albedo * bsdf_pdf
+	return albedo * radiance * (bsdf_pdf * power_heuristic(light_pdf, bsdf_pdf) / light_pdf);
+}
 
-    return emitted + attenuation * ray_color(scattered, background, world, depth-1);
+/* Shades a hit point: adds emission and follows the scattered ray.
+*	@r: The ray that produced the hit.
+*	@rec: The hit record of the closest hit.
+*	@world: The list of hittable objects to test ray intersection with
+*	@materials: The scene's material table, indexed by rec.mat_id
+*	@lights: The lights sampled at diffuse hits, may be empty
+*	@samples: The sample's numbers, moved on to this bounce here
+*	@depth: The remaining depth of recursion
+*	@scattered_pdf: The density with which r was scattered, see ray_color
+*	@seen: The denoiser features, see ray_color
+*/
+vec3 shade(const ray& r, const hit_record& rec, const vec3& background, const hittable& world,
+		   const material_table& materials, const light_list& lights, sample_stream& samples,
+		   int depth, real scattered_pdf, pixel_features* seen) {
+	const material& mat = materials[rec.mat_id];
+	if (seen && !record_hit(*seen, mat, rec, rec.t * r.direction().length()))
+		seen = nullptr;
+	ray scattered;
+	vec3 attenuation;
+	vec3 emitted_color = emitted(mat, rec.u, rec.v, rec.p);
+
+	// The previous diffuse hit also sampled this light directly.
+	if (scattered_pdf > 0 && mat.type == DIFFUSE_LIGHT)
+		emitted_color *= power_heuristic(scattered_pdf, lights.pdf(rec.obj, r.origin(), r.direction()));
+
+	samples.next_bounce();
+	if (!scatter(mat, r, rec, attenuation, scattered, samples.get(BOUNCE_DIRECTION),
+				 samples.get(BOUNCE_DIRECTION + 1), samples.get(BOUNCE_CHOICE)))
+		return emitted_color;
+
+	vec3 direct(0,0,0);
+	real pdf = 0;
+	if (!lights.empty()) {
+		pdf = scatter_pdf(mat, rec, scattered);
+		if (mat.type == LAMBERTIAN)
+			direct = direct_light(rec, attenuation, world, materials, lights, samples);
+	}
+	return emitted_color + direct
+		+ attenuation * ray_color(scattered, background, world, materials, lights, samples, depth-1, pdf, seen);
+}
+
+/* Traces a packet of camera rays through the world together, then shades
+*	each lane on its own. Only the primary hit uses the packet; everything
+*	after the first bounce is incoherent and goes back to single rays.
+*	@p: The packet of camera rays.
+*	@active: The lanes that hold real rays.
+*	@world: The list of hittable objects to test ray intersection with
+*	@materials: The scene's material table
+*	@lights: The lights sampled at diffuse hits, may be empty
+*	@samples: The numbers of every lane's sample
+*	@depth: The max amount of depth of recursion
+*	@colors: Receives the color of every active lane.
+*	@features: If not null, receives what every active lane saw, for the
+*	denoiser
+*/
+void packet_color(const ray_packet& p, lane_mask active, const vec3& background,
+				  const hittable& world, const material_table& materials, const light_list& lights,
+				  sample_stream* samples, int depth, vec3* colors, pixel_features* features = nullptr) {
+	packet_hits hits;
+	hits.hit = 0;
+	for (int i = 0; i < PACKET_SIZE; i++)
+		hits.t_max[i] = infinity;
+
+	world.hit_packet(p, 0.001, hits, active);
+
+	for (int i = 0; i < PACKET_SIZE; i++) {
+		if (!(active >> i & 1)) continue;
+		num_rays += 1;
+		if (hits.hit >> i & 1) {
+			ray r = p.get(i);
+			hits.rec[i].obj->get_surface(r, hits.rec[i]);
+			if (features)
+				features[i] = pixel_features();
+			colors[i] = shade(r, hits.rec[i], background, world, materials, lights, samples[i], depth, 0,
+							  features ? &features[i] : nullptr);
+		} else {
+			colors[i] = background;
+			if (features) {
+				features[i] = pixel_features();
+				record_miss(features[i]);
+			}
+		}
+	}
 }
 
 /*	Generates a scene to demonstrate area lighting
+*	@materials: material table the scene's materials are added to
+*	@lights: receives the scene's lights
+*	@mem: arena the primitives are placed in, may be null
 *	returns a hittable list of objects in the scene
 */
-hittable_list area_light() {
+hittable_list area_light(material_table& materials, light_list& lights, arena* mem) {
     hittable_list objects;
 
     auto pertext = make_shared<noise_texture>(4);
-    //objects.add(make_shared<sphere>(vec3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
-    //objects.add(make_shared<sphere>(vec3(0,2,0), 2, make_shared<lambertian>(pertext)));
-	objects.add(make_shared<sphere>(vec3(0,-1000,0), 1000, make_shared<lambertian>(vec3(0.5,0.3,0.9))));
-	objects.add(make_shared<sphere>(vec3(0,2,0), 2, make_shared<metal>(vec3(0,0.2,0.9))));
-	//objects.add(make_shared<sphere>(vec3(-20,4.5,5), 5, make_shared<metal>(vec3(0.8,0.2,0.2))));
-	objects.add(make_shared<sphere>(vec3(7,2,5), 2, make_shared<metal>(vec3(0.8,0.8,0.2))));
-
-    auto difflight = make_shared<diffuse_light>(vec3(4,4,4));
-    objects.add(make_shared<sphere>(vec3(0,7,0), 2, difflight));
-    objects.add(make_shared<xy_rect>(3, 5, 1, 3, -2, difflight));
+    //objects.add(make_shared<sphere>(vec3(0,-1000,0), 1000, materials.add(lambertian(pertext))));
+    //objects.add(make_shared<sphere>(vec3(0,2,0), 2, materials.add(lambertian(pertext))));
+	objects.add(make_in<sphere>(mem, vec3(0,-1000,0), 1000, materials.add(lambertian(vec3(0.5,0.3,0.9)))));
+	objects.add(make_in<sphere>(mem, vec3(0,2,0), 2, materials.add(metal(vec3(0,0.2,0.9)))));
+	//objects.add(make_shared<sphere>(vec3(-20,4.5,5), 5, materials.add(metal(vec3(0.8,0.2,0.2)))));
+	objects.add(make_in<sphere>(mem, vec3(7,2,5), 2, materials.add(metal(vec3(0.8,0.8,0.2)))));
+
+    auto difflight = materials.add(diffuse_light(vec3(4,4,4)));
+    auto sphere_light = make_in<sphere>(mem, vec3(0,7,0), 2, difflight);
+    auto rect_light = make_in<xy_rect>(mem, 3, 5, 1, 3, -2, difflight);
+    objects.add(sphere_light);
+    objects.add(rect_light);
+    lights.add(sphere_light, materials[difflight]);
+    lights.add(rect_light, materials[difflight]);
 
     return objects;
 }
 
+/*	Generates a field of n small random spheres on a ground sphere. The small
+*	spheres all live in one sphere_set, so large n costs no heap object per sphere.
+*	@materials: material table the scene's materials are added to
+*	@lights: receives the scene's lights
+*	@n: number of small spheres
+*	@mem: arena the primitives are placed in, may be null
+*	returns a hittable list of objects in the scene
+*/
+hittable_list sphere_field(material_table& materials, light_list& lights, int n, arena* mem) {
+	hittable_list objects;
+	objects.add(make_in<sphere>(mem, vec3(0,-1000,0), 1000, materials.add(lambertian(vec3(0.5,0.5,0.5)))));
+
+	int palette[4];
+	palette[0] = materials.add(lambertian(vec3(0.7, 0.3, 0.3)));
+	palette[1] = materials.add(lambertian(vec3(0.2, 0.3, 0.8)));
+	palette[2] = materials.add(metal(vec3(0.8, 0.6, 0.2)));
+	palette[3] = materials.add(dielectric(1.5));
+
+	auto field = make_in<sphere_set>(mem);
+	for (int i = 0; i < n; i++) {
+		real radius = 0.05 + 0.15 * random_double();
+		vec3 center(random_double(-20, 20), radius, random_double(-20, 20));
+		field->add(center, radius, palette[i % 4]);
+	}
+	field->build();
+	objects.add(field);
+
+	int light_mat = materials.add(diffuse_light(vec3(4,4,4)));
+	auto light = make_in<sphere>(mem, vec3(0,12,0), 4, light_mat);
+	objects.add(light);
+	lights.add(light, materials[light_mat]);
+	return objects;
+}
+
+/*	Generates a scene lit by n small sphere lights whose brightness spans
+*	three orders of magnitude, for testing light selection.
+*	@materials: material table the scene's materials are added to
+*	@lights: receives the scene's lights
+*	@n: number of lights
+*	@mem: arena the primitives are placed in, may be null
+*	returns a hittable list of objects in the scene
+*/
+hittable_list light_field(material_table& materials, light_list& lights, int n, arena* mem) {
+	hittable_list objects;
+	objects.add(make_in<sphere>(mem, vec3(0,-1000,0), 1000, materials.add(lambertian(vec3(0.5,0.5,0.5)))));
+	objects.add(make_in<sphere>(mem, vec3(0,2,0), 2, materials.add(lambertian(vec3(0.7, 0.3, 0.3)))));
+
+	for (int i = 0; i < n; i++) {
+		real brightness = std::pow(10.0, random_double(-1, 2));
+		int m = materials.add(diffuse_light(brightness * vec3(random_double(0.5, 1), random_double(0.5, 1), 1)));
+		auto light = make_in<sphere>(mem, vec3(random_double(-15, 15), random_double(0.5, 6), random_double(-15, 15)),
+										  random_double(0.05, 0.2), m);
+		objects.add(light);
+		lights.add(light, materials[m]);
+	}
+	return objects;
+}
+
 /* The main method to run everything.
-*	compile using: g++ mp1.cpp -std=c++11 -o mp1
+*	compile using: g++ mp1.cpp -std=c++11 -O2 -fno-math-errno -pthread -o mp1 (the image is
+*	written on a thread; -O2 -fno-math-errno lets gcc vectorize the sphere_set leaf and the
+*	packet box, sphere and triangle kernels)
+*	add -mavx2 to run those kernels 8 floats or 4 doubles wide instead of 4 or 2
+*	add -DSINGLE_PRECISION to trace in float instead of double
+*	add -DWAVEFRONT to render with the wavefront integrator, plus
+*	-DWAVEFRONT_SORT to reorder secondary rays by origin and direction
+*	add -DDENOISE to filter the image before it is written (the noisy one
+*	goes to output_noisy.pfm), for clean images at 16-32 samples
 *	./mp2 0 400 1.7 > output.ppm
+*	the unclamped image is also written to output.pfm, see tonemap.cpp
 *	@argc: The size of args array
 *	@args: The arguments provided by the command line
 */
@@ -159,27 +352,49 @@ int main() {
 	cameraDefault cam;
 
     // World
+	// Primitives, BVH nodes and leaf lists live in an arena that is freed
+	// in one go with the scene; it is declared first so it outlives them.
+	arena mem;
+	material_table materials;
+	light_list lights;	// sampled directly at diffuse hits, see direct_light
 	hittable_list world;
 
-    auto material_ground = make_shared<lambertian>(vec3(0.8, 0.8, 0.0));
-    auto material_center = make_shared<lambertian>(vec3(0.7, 0.3, 0.3));
-    //auto material_left   = make_shared<metal>(vec3(0.8, 0.8, 0.8));
-	auto material_left   = make_shared<dielectric>(1.5);
-    auto material_right  = make_shared<metal>(vec3(0.8, 0.6, 0.2));
-	auto metal1  = make_shared<metal>(vec3(0.8, 0.3, 0.7));
-	auto metal2  = make_shared<metal>(vec3(0.2, 0.3, 0.8));
-	auto metal3  = make_shared<metal>(vec3(0.2, 0.9, 0.8));
-	auto glass1   = make_shared<dielectric>(1.2);
-
-    world.add(make_shared<sphere>(vec3( 0.0, -100.5, -1.5), 100.0, material_ground));
-    world.add(make_shared<sphere>(vec3( 0.8,    0.8, -3),   1.0, material_center));	// lambertian center
-    world.add(make_shared<sphere>(vec3(-2.0,    0.0, -1.5),   0.5, material_left));
-    world.add(make_shared<sphere>(vec3( 2.0,    0.0, -1.5),   0.5, material_right));
-
-	/*world.add(make_shared<sphere>(vec3(-2.0,    2, -1.5),   0.5, metal1));
-	world.add(make_shared<sphere>(vec3( 0,      0, -1.5),   0.5, glass1));
-	world.add(make_shared<sphere>(vec3( 4.0,    0.0, -1.5),   0.5, metal2));
-	world.add(make_shared<sphere>(vec3(-4.0,    0.0, -1.5),   0.5, metal3));*/
+    auto material_ground = materials.add(lambertian(vec3(0.8, 0.8, 0.0)));
+    auto material_center = materials.add(lambertian(vec3(0.7, 0.3, 0.3)));
+    //auto material_left   = materials.add(metal(vec3(0.8, 0.8, 0.8)));
+	auto material_left   = materials.add(dielectric(1.5));
+    auto material_right  = materials.add(metal(vec3(0.8, 0.6, 0.2)));
+
+    world.add(make_in<sphere>(&mem, vec3( 0.0, -100.5, -1.5), 100.0, material_ground));
+    world.add(make_in<sphere>(&mem, vec3( 0.8,    0.8, -3),   1.0, material_center));	// lambertian center
+    world.add(make_in<sphere>(&mem, vec3(-2.0,    0.0, -1.5),   0.5, material_left));
+    world.add(make_in<sphere>(&mem, vec3( 2.0,    0.0, -1.5),   0.5, material_right));
+
+	/*auto metal1  = materials.add(metal(vec3(0.8, 0.3, 0.7)));
+	auto metal2  = materials.add(metal(vec3(0.2, 0.3, 0.8)));
+	auto metal3  = materials.add(metal(vec3(0.2, 0.9, 0.8)));
+	auto glass1   = materials.add(dielectric(1.2));
+	world.add(make_in<sphere>(&mem, vec3(-2.0,    2, -1.5),   0.5, metal1));
+	world.add(make_in<sphere>(&mem, vec3( 0,      0, -1.5),   0.5, glass1));
+	world.add(make_in<sphere>(&mem, vec3( 4.0,    0.0, -1.5),   0.5, metal2));
+	world.add(make_in<sphere>(&mem, vec3(-4.0,    0.0, -1.5),   0.5, metal3));*/
+
+	// A mesh larger than memory: convert it to a cluster file once (this
+	// step needs it in memory), then render from the file with at most
+	// 512 MB of it resident. With -DWAVEFRONT leave it out of world and
+	// hand it to the integrator instead (integrator.stream(city.get())).
+	// Converting needs util/TriMesh.h.
+	/*{
+		char name[] = "city.ply";
+		TriMesh city(name, vec3(0.7, 0.7, 0.7), vec3(0.2, 0.2, 0.2));
+		string error;
+		if (!city.writeClusters("city.clusters", 4096, material_center, error))
+			cerr << error << endl;
+	}
+	auto city = make_shared<streamed_mesh>("city.clusters", size_t(512) << 20);
+	if (!city->ok())
+		cerr << city->last_error() << endl;
+	world.add(city);*/
 
 	// Image
 
@@ -198,7 +413,9 @@ int main() {
 
     // Camera
     //AREA LIGHTS
-	world = area_light();
+	world = area_light(materials, lights, &mem);
+	//world = sphere_field(materials, lights, 1000000, &mem);
+	//world = light_field(materials, lights, 500, &mem);
     samples_per_pixel = 400; // 400
     lookfrom = vec3(26,3,6);
     lookat = vec3(0,2,0);
@@ -214,24 +431,130 @@ int main() {
 
     // Render
 
-    std::cout << "P3\n" << image_width << " " << image_height << "\n255\n";
-
-    for (int j = image_height-1; j >= 0; --j) {
-        //std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < image_width; ++i) {
-            vec3 pixel_color(0, 0, 0);
-            for (int s = 0; s < samples_per_pixel; ++s) {
-                auto u = (i + random_double()) / (image_width-1);
-                auto v = (j + random_double()) / (image_height-1);
-                ray r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, background, world, max_depth);
-            }
-            write_color(std::cout, pixel_color, samples_per_pixel);
-        }
-    }
+	lights.build();
+	if (!lights.empty())
+		lights.print(std::cerr);
+
+	// Ground spheres/planes stay out of the BVH, see scene.h.
+	scene top(world, 0, 1, 32, &mem);
+
+	// Finished rows go to a writer thread that tonemaps them to the ppm on
+	// stdout and stores the linear floats in the pfm while rendering goes
+	// on. Exposure and gamma can be changed later without re-rendering:
+	// ./tonemap output.pfm output.ppm [stops] [gamma]
+	image_writer writer(std::cout, hdr_path, image_width, image_height, 1.0f, gam, false);
+
+	// Every random number of a pixel sample comes from here: the pixel and
+	// lens position and a block of dimensions per bounce, see sampler.h.
+	auto sampler_start = high_resolution_clock::now();
+	sampler samples(SAMPLER_KIND, samples_per_pixel);
+	std::cerr << "sampler tables built in "
+			  << duration<double, std::milli>(high_resolution_clock::now() - sampler_start).count() << " ms\n";
+
+#ifdef DENOISE
+	// The filter needs the whole image, so rows only go to the writer once
+	// it is done. What every camera path saw first is recorded to guide it.
+	framebuffer noisy(image_width, image_height);
+	feature_buffers features(image_width, image_height);
+#endif
+
+#ifdef WAVEFRONT
+	// Batches of paths advance one bounce at a time through separate
+	// generate/extend/sort/shade/accumulate passes, see wavefront.h. Every
+	// batch covers the whole image, so rows are only done at the end.
+	framebuffer image;
+	wavefront_integrator integrator(top, materials, background, max_depth);
+	integrator.sample_lights(&lights);
+	integrator.use_sampler(&samples);
+#ifdef DENOISE
+	integrator.capture_features(&features);
+#endif
+	//integrator.stream(city.get());
+	integrator.render(cam, image_width, image_height, samples_per_pixel, image);
+	integrator.stats.print(std::cerr);
+	//city->stats().print(std::cerr);
+	image.scale(1.0f / samples_per_pixel);
+#ifdef DENOISE
+	noisy.rgb.swap(image.rgb);
+#else
+	for (int j = image_height - 1; j >= 0; --j)
+		writer.push_row(j, &image.rgb[3 * static_cast<size_t>(j) * image_width]);
+#endif
+#else
+	// Camera rays are traced in PACKET_DIM x PACKET_DIM tiles of pixels, one
+	// band of PACKET_DIM rows at a time from the top, so each band is
+	// handed to the writer as soon as it is done.
+	framebuffer band(image_width, PACKET_DIM);
+	for (int tj = (image_height - 1) / PACKET_DIM * PACKET_DIM; tj >= 0; tj -= PACKET_DIM) {
+		band.reset(image_width, PACKET_DIM);
+		for (int ti = 0; ti < image_width; ti += PACKET_DIM) {
+			for (int s = 0; s < samples_per_pixel; ++s) {
+				ray_packet packet;
+				sample_stream streams[PACKET_SIZE];
+				lane_mask active = 0;
+				for (int l = 0; l < PACKET_SIZE; l++) {
+					int i = ti + l % PACKET_DIM;
+					int j = tj + l / PACKET_DIM;
+					if (i >= image_width || j >= image_height) {
+						packet.set(l, ray(vec3(0,0,0), vec3(0,0,1)));
+						continue;
+					}
+					uint32_t pix = j * image_width + i;
+					auto u = (i + samples.get(pix, s, SAMPLE_PIXEL)) / (image_width-1);
+					auto v = (j + samples.get(pix, s, SAMPLE_PIXEL + 1)) / (image_height-1);
+					packet.set(l, cam.get_ray(u, v, samples.get(pix, s, SAMPLE_LENS), samples.get(pix, s, SAMPLE_LENS + 1)));
+					streams[l] = sample_stream(&samples, pix, s);
+					active |= lane_mask(1) << l;
+				}
+
+				vec3 colors[PACKET_SIZE];
+#ifdef DENOISE
+				pixel_features seen[PACKET_SIZE];
+				packet_color(packet, active, background, top, materials, lights, streams, max_depth, colors, seen);
+				for (int l = 0; l < PACKET_SIZE; l++) {
+					if (active >> l & 1)
+						features.add((tj + l / PACKET_DIM) * image_width + ti + l % PACKET_DIM, seen[l], colors[l]);
+				}
+#else
+				packet_color(packet, active, background, top, materials, lights, streams, max_depth, colors);
+#endif
+				for (int l = 0; l < PACKET_SIZE; l++) {
+					if (active >> l & 1)
+						band.add((l / PACKET_DIM) * image_width + ti + l % PACKET_DIM, colors[l]);
+				}
+			}
+		}
+		band.scale(1.0f / samples_per_pixel);
+		for (int j = std::min(tj + PACKET_DIM, image_height) - 1; j >= tj; --j) {
+#ifdef DENOISE
+			std::copy(&band.rgb[3 * static_cast<size_t>(j - tj) * image_width],
+					  &band.rgb[3 * static_cast<size_t>(j - tj + 1) * image_width],
+					  &noisy.rgb[3 * static_cast<size_t>(j) * image_width]);
+#else
+			writer.push_row(j, &band.rgb[3 * static_cast<size_t>(j - tj) * image_width]);
+#endif
+		}
+	}
+#endif
+
+#ifdef DENOISE
+	features.average(samples_per_pixel);
+	if (!noisy.write_pfm("output_noisy.pfm"))
+		std::cerr << "writing output_noisy.pfm failed" << std::endl;
+	framebuffer clean;
+	denoiser filter;
+	filter.run(noisy, features, clean);
+	filter.print(std::cerr);
+	for (int j = image_height - 1; j >= 0; --j)
+		writer.push_row(j, &clean.rgb[3 * static_cast<size_t>(j) * image_width]);
+#endif
+
+	if (!writer.finish())
+		std::cerr << "writing the image failed" << std::endl;
+	writer.print(std::cerr);
 
 	// Get Time of program and number of rays sent into the scene. 
-	// Comment out write_color above and uncomment below.
+	// Comment out the image writer above and uncomment below.
 	/*
 	auto program_stop = high_resolution_clock::now();
 	// Subtract stop and start timepoints and 
@@ -0,0 +1,63 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <stdlib.h>
+#include "util/framebuffer.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/* Turns a linear HDR image written by the renderer (PFM) into a display
+*	image (binary PPM), so exposure and gamma can be tried without
+*	re-rendering.
+*	compile using: g++ tonemap.cpp -std=c++11 -O3 -ffast-math -march=native -o tonemap
+*	(-ffast-math lets powf vectorize for gammas other than 2)
+*	./tonemap output.pfm output.ppm [exposure in stops, default 0] [gamma, default 2]
+*	@argc: The size of args array
+*	@args: The arguments provided by the command line
+*/
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		cerr << "usage: " << argv[0] << " in.pfm out.ppm [stops] [gamma]" << endl;
+		return 1;
+	}
+	const float stops = argc > 3 ? static_cast<float>(atof(argv[3])) : 0.0f;
+	const float gamma = argc > 4 ? static_cast<float>(atof(argv[4])) : 2.0f;
+	if (!(gamma > 0)) {
+		cerr << "gamma must be positive" << endl;
+		return 1;
+	}
+
+	auto t0 = high_resolution_clock::now();
+	framebuffer image;
+	string error;
+	if (!image.read_pfm(argv[1], error)) {
+		cerr << argv[1] << ": " << error << endl;
+		return 1;
+	}
+	auto t1 = high_resolution_clock::now();
+
+	vector<unsigned char> ldr(image.rgb.size());
+	if (!ldr.empty())
+		tonemap(&image.rgb[0], &ldr[0], ldr.size(), std::exp2(stops), gamma);
+	auto t2 = high_resolution_clock::now();
+
+	ofstream out(argv[2], ios::binary);
+	out << "P6\n" << image.width << " " << image.height << "\n255\n";
+	const size_t row = 3 * static_cast<size_t>(image.width);
+	for (int j = image.height - 1; j >= 0; --j)
+		out.write(reinterpret_cast<const char*>(&ldr[j * row]), row);
+	out.close();
+	if (!out) {
+		perror(argv[2]);
+		return 1;
+	}
+	auto t3 = high_resolution_clock::now();
+
+	cerr << image.width << "x" << image.height << " | read " << duration<double, milli>(t1 - t0).count()
+		 << " ms, tonemap " << duration<double, milli>(t2 - t1).count() << " ms, write "
+		 << duration<double, milli>(t3 - t2).count() << " ms" << endl;
+	return 0;
+}
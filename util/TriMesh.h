@@ -7,11 +7,29 @@
 #include <sstream>
 #include <sstream>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <unordered_map>
+#include <thread>
+#include <vector>
+
 #include "hittable_list.h"
+#include "arena.h"
+#include "mapped_file.h"
+#include "obj_parse.h"
+#include "ply_parse.h"
+#include "compressed_mesh.h"
+#include "streamed_mesh.h"
 #include "TriangleMesh.cpp"
 
 using namespace std;
 
+// Threads used to parse obj files, 0 means one per hardware thread.
+#ifndef OBJ_LOAD_THREADS
+#define OBJ_LOAD_THREADS 0
+#endif
+
 class TriMesh {
 	public:
 	TriMesh() {}
@@ -21,86 +39,310 @@ class TriMesh {
 		ks = ksi;
 	}
 
-	/*	Loads an obj file
+	/*	Loads an obj file. The file is memory-mapped and split into one
+	*	chunk per hardware thread (at line boundaries); the chunks are parsed
+	*	in parallel and then concatenated in order. Reads positions, texture
+	*	coordinates, normals, faces with any number of corners (triangulated
+	*	as a fan), "p/t/n" corners, negative indices and usemtl groups.
+	*	Timings go to stderr.
 	*/
 	void loadFromOBJ() {
-		FILE* stream;
-		size_t len = 0;
-		ssize_t nread = 0;
+		typedef std::chrono::high_resolution_clock clock;
+		clock::time_point t0 = clock::now();
 
-		stream = fopen(fileName, "r");
-		char* line = NULL;
+		mapped_file file(fileName);
+		if (!file.ok()) {
+			perror("open");
+			exit(EXIT_FAILURE);
+		}
+		clock::time_point t1 = clock::now();
 
-		if (stream == NULL) {
-            perror("fopen");
-            exit(EXIT_FAILURE);
-        }
+		// Not worth a thread per core for small files.
+		int num_chunks = load_threads(file.size() / (1 << 20) + 1);
 
-		while ((nread = getline(&line, &len, stream)) != -1) {
-			if (line[0] == '#') {
-				continue;
-			} else {
-				//fwrite(line, nread, 1, stdout);
-				if (line[0] == 'v') {
-					stringstream ss(line);
-					string m = line;
-					int axis = 0;
-					vec3 vec;
-					while (getline(ss,m,' ')) {
-						if (m[0] == 'v' || m[0] == '\n') continue;
-						if (axis == 2) m[m.size()-1] = '\0';
-						if (axis >= 4) break;
-						//cout << "axis = " << axis << endl;
-						//cout << "here = " << m << endl; // m might be \n
-						vec[axis] = stod(m);
-						axis += 1;
+		std::vector<const char*> bounds(num_chunks + 1);
+		bounds[0] = file.data();
+		bounds[num_chunks] = file.end();
+		for (int c = 1; c < num_chunks; c++) {
+			const char* p = file.data() + file.size() * c / num_chunks;
+			p = std::max(p, bounds[c-1]);
+			while (p < file.end() && *p != '\n') p++;
+			bounds[c] = (p < file.end()) ? p + 1 : p;
+		}
+
+		std::vector<obj_chunk> chunks(num_chunks);
+		std::vector<std::thread> threads;
+		for (int c = 1; c < num_chunks; c++)
+			threads.push_back(std::thread(parse_obj_chunk, bounds[c], bounds[c+1], &chunks[c]));
+		parse_obj_chunk(bounds[0], bounds[1], &chunks[0]);
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+		clock::time_point t2 = clock::now();
+
+		obj_mesh m;
+		merge_obj_chunks(chunks, m);
+		string error;
+		if (!check_obj_indices(m, error)) {
+			cerr << fileName << ": " << error << endl;
+			exit(EXIT_FAILURE);
+		}
+		vertices.swap(m.positions);
+		texcoords.swap(m.texcoords);
+		file_normals.swap(m.normals);
+		indices.swap(m.indices);
+		uv_indices.swap(m.uv_indices);
+		normal_indices.swap(m.normal_indices);
+		face_materials.swap(m.face_materials);
+		material_names.swap(m.material_names);
+		// Drop the per-corner arrays that carry no information.
+		if (texcoords.empty()) vector<int>().swap(uv_indices);
+		if (file_normals.empty()) vector<int>().swap(normal_indices);
+		if (material_names.empty()) vector<int>().swap(face_materials);
+
+		numVertices = vertices.size();
+		numFaces = indices.size() / 3;
+		clock::time_point t3 = clock::now();
+		computeNormals();
+		clock::time_point t4 = clock::now();
+
+		double map_s = std::chrono::duration<double>(t1 - t0).count();
+		double parse_s = std::chrono::duration<double>(t2 - t1).count();
+		double merge_s = std::chrono::duration<double>(t3 - t2).count();
+		double normals_s = std::chrono::duration<double>(t4 - t3).count();
+		double total_s = std::chrono::duration<double>(t4 - t0).count();
+		cerr << "loaded " << fileName << ": " << numVertices << " vertices, " << numFaces << " faces, "
+			 << file.size() / 1e6 << " MB on " << num_chunks << " threads | map " << map_s * 1000
+			 << " ms, parse " << parse_s * 1000 << " ms, merge " << merge_s * 1000 << " ms, normals "
+			 << normals_s * 1000 << " ms | " << (total_s > 0 ? file.size() / total_s / 1e9 : 0) << " GB/s" << endl;
+	}
+
+	/*	Loads a binary (little or big endian) ply file. The file is
+	*	memory-mapped and the vertex and face blocks are read in place:
+	*	with float x, y, z as the only vertex properties (and a float,
+	*	unpadded vec3) the vertex block is copied with a single memcpy, and
+	*	triangles stored as "list uchar int" are copied 12 bytes at a time.
+	*	Other layouts and byte orders go through a per-property decode.
+	*	Faces with more than 3 corners are triangulated as a fan. Timings go
+	*	to stderr.
+	*/
+	void loadFromPLY() {
+		typedef std::chrono::high_resolution_clock clock;
+		clock::time_point t0 = clock::now();
+
+		mapped_file file(fileName);
+		if (!file.ok()) {
+			perror("open");
+			exit(EXIT_FAILURE);
+		}
+
+		ply_header header;
+		string error;
+		if (!parse_ply_header(file.data(), file.end(), header, error)) {
+			cerr << fileName << ": " << error << endl;
+			exit(EXIT_FAILURE);
+		}
+		const bool swap = header.big_endian != host_is_big_endian();
+
+		vertices.clear();
+		indices.clear();
+		texcoords.clear();
+		file_normals.clear();
+		uv_indices.clear();
+		normal_indices.clear();
+		face_materials.clear();
+		material_names.clear();
+
+		bool fast_vertices = false, fast_faces = false;
+		const char* p = file.data() + header.data_offset;
+		for (size_t e = 0; e < header.elements.size(); e++) {
+			const ply_element& el = header.elements[e];
+			const size_t stride = el.stride();
+			const char* next = (stride > 0) ? p + stride * el.count : NULL;
+			if (stride > 0 && (next < p || next > file.end()))
+				ply_truncated();
+
+			if (el.name == "vertex") {
+				int ix = el.find("x"), iy = el.find("y"), iz = el.find("z");
+				if (ix < 0 || iy < 0 || iz < 0 || stride == 0) {
+					cerr << fileName << ": vertex element needs fixed-size x, y, z" << endl;
+					exit(EXIT_FAILURE);
+				}
+				size_t off[3] = { 0, 0, 0 };
+				int id[3] = { ix, iy, iz };
+				for (int a = 0; a < 3; a++)
+					for (int k = 0; k < id[a]; k++)
+						off[a] += ply_type_size(el.props[k].type);
+
+				vertices.resize(el.count);
+				fast_vertices = !swap && stride == 3 * sizeof(float) && ix == 0 && iy == 1 && iz == 2
+					&& el.props[0].type == PLY_FLOAT32 && el.props[1].type == PLY_FLOAT32
+					&& el.props[2].type == PLY_FLOAT32
+					&& sizeof(real) == sizeof(float) && sizeof(vec3) == 3 * sizeof(float);
+				if (fast_vertices && el.count > 0) {
+					memcpy(&vertices[0], p, stride * el.count);
+				} else {
+					for (size_t i = 0; i < el.count; i++) {
+						const char* item = p + i * stride;
+						for (int a = 0; a < 3; a++)
+							vertices[i][a] = static_cast<real>(ply_read(item + off[a], el.props[id[a]].type, swap));
 					}
-					vertices.push_back(vec);
-				} else if (line[0] == 'f') {
-					stringstream ss(line);
-					string m = line;
-					int axis = 0;
-					vec3 vec;
-					while (getline(ss,m,' ')) {
-						if (m[0] == 'f' || m[0] == '\n') continue;
-						if (axis == 2) m[m.size()-1] = '\0';
-						if (axis >= 4) break;
-						//cout << "axis = " << axis << endl;
-						//cout << "here = " << m << endl; // m might be \n
-						vec[axis] = stoi(m);
-						axis += 1;
+				}
+				p = next;
+			} else if (el.name == "face") {
+				int il = el.find("vertex_indices");
+				if (il < 0) il = el.find("vertex_index");
+				if (il < 0 || !el.props[il].is_list) {
+					cerr << fileName << ": face element needs a vertex_indices list" << endl;
+					exit(EXIT_FAILURE);
+				}
+				const ply_property& list = el.props[il];
+
+				fast_faces = !swap && el.props.size() == 1 && list.count_type == PLY_UINT8
+					&& (list.type == PLY_INT32 || list.type == PLY_UINT32);
+				// Sized for all triangles; n-gons grow it, the end trims it.
+				size_t w = indices.size();
+				indices.resize(w + 3 * el.count);
+				vector<int> poly;
+				for (size_t i = 0; i < el.count; i++) {
+					if (fast_faces && p + 13 <= file.end() && static_cast<unsigned char>(*p) == 3) {
+						memcpy(&indices[w], p + 1, 3 * sizeof(int));
+						w += 3;
+						p += 13;
+						continue;
+					}
+					// General item: walk the properties, triangulate the list.
+					poly.clear();
+					for (size_t k = 0; k < el.props.size(); k++) {
+						const ply_property& prop = el.props[k];
+						if (!prop.is_list) {
+							p += ply_type_size(prop.type);
+							continue;
+						}
+						if (p + ply_type_size(prop.count_type) > file.end()) ply_truncated();
+						size_t n = static_cast<size_t>(ply_read(p, prop.count_type, swap));
+						p += ply_type_size(prop.count_type);
+						int item = ply_type_size(prop.type);
+						if (p + n * item > file.end()) ply_truncated();
+						if (static_cast<int>(k) == il)
+							for (size_t c = 0; c < n; c++)
+								poly.push_back(static_cast<int>(ply_read(p + c * item, prop.type, swap)));
+						p += n * item;
+					}
+					if (poly.size() < 3)
+						continue;
+					size_t need = 3 * (poly.size() - 2);
+					if (w + need > indices.size())
+						indices.resize(w + need + 3 * (el.count - i - 1));
+					for (size_t c = 1; c + 1 < poly.size(); c++) {
+						indices[w++] = poly[0];
+						indices[w++] = poly[c];
+						indices[w++] = poly[c + 1];
 					}
-					faces.push_back(vec);
-				} else {
-					continue;
 				}
+				indices.resize(w);
+			} else if (stride > 0) {
+				p = next;
+			} else {
+				for (size_t i = 0; i < el.count; i++)
+					if (!(p = ply_skip_item(p, file.end(), el, swap))) ply_truncated();
 			}
 		}
-		numVertices = vertices.size();
-		numFaces = faces.size();
 
-		for (int i = 0; i < numVertices; i++) {
-			normals.push_back(vec3(0,0,0));
+		numVertices = vertices.size();
+		numFaces = indices.size() / 3;
+		for (size_t i = 0; i < indices.size(); i++) {
+			if (indices[i] < 0 || indices[i] >= numVertices) {
+				cerr << fileName << ": face index " << indices[i] << " out of range" << endl;
+				exit(EXIT_FAILURE);
+			}
 		}
+		clock::time_point t1 = clock::now();
+		computeNormals();
+		clock::time_point t2 = clock::now();
 
-		//cout << numVertices << endl;
-		//cout << numFaces << endl;
-		//printVertices();
-		//printFaces();
+		double read_s = std::chrono::duration<double>(t1 - t0).count();
+		double normals_s = std::chrono::duration<double>(t2 - t1).count();
+		double total_s = std::chrono::duration<double>(t2 - t0).count();
+		cerr << "loaded " << fileName << ": " << numVertices << " vertices, " << numFaces << " faces, "
+			 << file.size() / 1e6 << " MB, " << (header.big_endian ? "big" : "little") << " endian | vertices "
+			 << (fast_vertices ? "memcpy" : "decoded") << ", faces " << (fast_faces ? "memcpy" : "decoded")
+			 << " | read " << read_s * 1000 << " ms, normals " << normals_s * 1000 << " ms, " << (total_s > 0 ? file.size() / total_s / 1e9 : 0)
+			 << " GB/s" << endl;
 	}
 
-	/*	Generates the triangular mesh
+	/*	Computes the vertex normals: the area-weighted average of the
+	*	normals of the faces around each vertex. Face normals are computed
+	*	in parallel, then each vertex gathers from its faces through a
+	*	vertex-to-face table, so threads never write to the same vertex.
+	*	Called by the loaders.
+	*/
+	void computeNormals() {
+		const int threads = load_threads(static_cast<size_t>(numFaces) / (1 << 16) + 1);
+
+		// Unnormalized cross products, their length is twice the face area.
+		vector<vec3> face_normals(numFaces);
+		parallel_for(threads, numFaces, [&](size_t begin, size_t end) {
+			for (size_t f = begin; f < end; f++) {
+				const vec3& a = vertices[indices[3*f]];
+				const vec3& b = vertices[indices[3*f+1]];
+				const vec3& c = vertices[indices[3*f+2]];
+				face_normals[f] = cross(b - a, c - a);
+			}
+		});
+
+		// Faces around each vertex, as a counting sort of the corners.
+		vector<int> first(numVertices + 1, 0);
+		for (size_t i = 0; i < indices.size(); i++)
+			first[indices[i] + 1]++;
+		for (int v = 0; v < numVertices; v++)
+			first[v + 1] += first[v];
+		vector<int> faces(indices.size());
+		vector<int> fill(first.begin(), first.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+			faces[fill[indices[i]]++] = static_cast<int>(i / 3);
+
+		normals.resize(numVertices);
+		parallel_for(threads, numVertices, [&](size_t begin, size_t end) {
+			for (size_t v = begin; v < end; v++) {
+				vec3 n(0,0,0);
+				for (int k = first[v]; k < first[v + 1]; k++)
+					n += face_normals[faces[k]];
+				// Unused vertices and degenerate fans keep a zero normal.
+				normals[v] = (n.length_squared() > 0) ? normalize(n) : n;
+			}
+		});
+	}
+
+	/*	Generates the triangular mesh. The triangles interpolate the normals
+	*	and texture coordinates of this mesh, so it must outlive them.
+	*	@mem: arena to place the triangles in, or null to use the heap
+	*	@mat_id: material ID of the triangles that have no usemtl, or whose
+	*		usemtl name is not in material_ids
+	*	@material_ids: material_table IDs of the usemtl names
 	*	returns a hittable_list of triangles
 	*/
-	hittable_list generateTriangles() {
+	hittable_list generateTriangles(arena* mem = nullptr, int mat_id = -1,
+									const std::unordered_map<string, int>& material_ids = std::unordered_map<string, int>()) {
+		shading = mesh_shading();
+		shading.vertex_normals = normals.empty() ? nullptr : &normals[0];
+		shading.file_normals = file_normals.empty() ? nullptr : &file_normals[0];
+		shading.texcoords = texcoords.empty() ? nullptr : &texcoords[0];
+
+		// Material table ID of every usemtl group
+		vector<int> group_ids(material_names.size(), mat_id);
+		for (size_t g = 0; g < material_names.size(); g++) {
+			std::unordered_map<string, int>::const_iterator it = material_ids.find(material_names[g]);
+			if (it != material_ids.end())
+				group_ids[g] = it->second;
+		}
+
 		// faces stores a vector of 3 vertices
 		// vertices stores a vector of 3 doubles
 		hittable_list triangles;
 		for (int i = 0; i < numFaces; i++) {
-			vec3 face = faces[i];
-			int index1 = face[0];
-			int index2 = face[1];
-			int index3 = face[2];
+			int index1 = indices[3*i] + 1;
+			int index2 = indices[3*i+1] + 1;
+			int index3 = indices[3*i+2] + 1;
 	
 			vec3 v1 = vertices[index1-1];
 			vec3 v2 = vertices[index2-1];
@@ -110,30 +352,135 @@ class TriMesh {
 			v2 *= 200;
 			v3 *= 200;
 			*/
+			// A uniform scale keeps the vertex normals valid.
 			v1 = uniformScale(v1, 50);
 			v2 = uniformScale(v2, 50);
 			v3 = uniformScale(v3, 50);
 			/*v1 = rotateAboutPoint(v1, 90, 1);
 			v2 = rotateAboutPoint(v2, 90, 1);
 			v3 = rotateAboutPoint(v3, 90, 1);*/
-			triangles.add(make_shared<TriangleMesh>(v1, v2, v3, kd, ks, index1, index2, index3));
+			int group = face_materials.empty() ? -1 : face_materials[i];
+			shared_ptr<TriangleMesh> t = make_in<TriangleMesh>(mem, v1, v2, v3, kd, ks, index1, index2, index3,
+															   &shading, group >= 0 ? group_ids[group] : mat_id);
+			t->set_corners(normal_indices.empty() ? nullptr : &normal_indices[3*i],
+						   uv_indices.empty() ? nullptr : &uv_indices[3*i]);
+			triangles.add(t);
+		}
+		//printNormals();
+		return triangles;
+	}
 
-			vec3 per_face_normal = cross(v2-v1, v3-v1);
-			//per_face_normal = normalize(per_face_normal);
-	
-			normals[index1-1] += per_face_normal;
-			normals[index2-1] += per_face_normal;
-			normals[index3-1] += per_face_normal;
+	/*	Merges vertices closer than tolerance into the first one seen, drops
+	*	the triangles that collapse and recomputes the normals. Candidates
+	*	are found through a hash grid with cells of the tolerance size, so
+	*	only the 27 cells around a vertex are searched.
+	*	@tolerance: max distance between welded vertices, 0 for exact copies
+	*	returns the number of vertices removed
+	*/
+	int weld(real tolerance) {
+		const real cell = tolerance;
+		const real tol2 = tolerance * tolerance;
+		const int reach = tolerance > 0 ? 1 : 0;
+
+		// Kept vertices, chained per grid cell through next.
+		std::unordered_map<uint64_t, int> head;
+		head.reserve(vertices.size());
+		vector<int> next;
+		vector<vec3> kept;
+		vector<int> remap(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++) {
+			const vec3& p = vertices[i];
+			long long c[3];
+			for (int a = 0; a < 3; a++) {
+				if (tolerance > 0) {
+					c[a] = static_cast<long long>(std::floor(p[a] / cell));
+				} else {
+					// Exact copies: the bits of the coordinate are the cell.
+					real x = p[a];
+					c[a] = 0;
+					memcpy(&c[a], &x, sizeof(real));
+				}
+			}
+			int found = -1;
+			for (int dx = -reach; dx <= reach && found < 0; dx++)
+				for (int dy = -reach; dy <= reach && found < 0; dy++)
+					for (int dz = -reach; dz <= reach && found < 0; dz++) {
+						auto it = head.find(cell_key(c[0] + dx, c[1] + dy, c[2] + dz));
+						for (int k = (it == head.end()) ? -1 : it->second; k >= 0; k = next[k])
+							if ((kept[k] - p).length_squared() <= tol2) {
+								found = k;
+								break;
+							}
+					}
+			if (found < 0) {
+				found = static_cast<int>(kept.size());
+				kept.push_back(p);
+				// Keys of different cells may collide; the distance test
+				// above makes that harmless.
+				std::pair<std::unordered_map<uint64_t, int>::iterator, bool> slot =
+					head.insert(std::make_pair(cell_key(c[0], c[1], c[2]), found));
+				next.push_back(slot.second ? -1 : slot.first->second);
+				slot.first->second = found;
+			}
+			remap[i] = found;
 		}
 
-		for (int i = 0; i < normals.size(); i++) {
-			normals[i] = normalize(normals[i]);
+		// Remap the faces and drop the degenerate ones with their attributes.
+		size_t w = 0;
+		for (int f = 0; f < numFaces; f++) {
+			int a = remap[indices[3*f]], b = remap[indices[3*f+1]], c = remap[indices[3*f+2]];
+			if (a == b || b == c || a == c)
+				continue;
+			indices[3*w] = a;
+			indices[3*w+1] = b;
+			indices[3*w+2] = c;
+			for (int k = 0; k < 3; k++) {
+				if (!uv_indices.empty()) uv_indices[3*w+k] = uv_indices[3*f+k];
+				if (!normal_indices.empty()) normal_indices[3*w+k] = normal_indices[3*f+k];
+			}
+			if (!face_materials.empty()) face_materials[w] = face_materials[f];
+			w++;
 		}
-		/*normals[0] = vec3(1,0,0);
-		normals[1] = vec3(0,1,0);
-		normals[2] = vec3(0,0,1);*/
-		//printNormals();
-		return triangles;
+		indices.resize(3 * w);
+		if (!uv_indices.empty()) uv_indices.resize(3 * w);
+		if (!normal_indices.empty()) normal_indices.resize(3 * w);
+		if (!face_materials.empty()) face_materials.resize(w);
+
+		int removed = numVertices - static_cast<int>(kept.size());
+		vertices.swap(kept);
+		numVertices = vertices.size();
+		numFaces = static_cast<int>(w);
+		computeNormals();
+		return removed;
+	}
+
+	/*	Builds a compressed_mesh (16-bit positions, packed normals, its own
+	*	BVH) from this mesh, with the same scale as generateTriangles. The
+	*	result does not refer back to this mesh.
+	*	@mat_id: material ID of the whole mesh
+	*	returns the mesh as one hittable
+	*/
+	shared_ptr<compressed_mesh> generateCompressed(int mat_id = -1) {
+		vector<vec3> scaled(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+			scaled[i] = uniformScale(vertices[i], 50);
+		return make_shared<compressed_mesh>(scaled, indices, normals, mat_id, kd, ks);
+	}
+
+	/*	Writes this mesh as a cluster file for streamed_mesh, with the same
+	*	scale as generateTriangles. This needs the mesh in memory once;
+	*	rendering from the file afterwards does not.
+	*	@path: the file to write
+	*	@cluster_triangles: max triangles per cluster
+	*	@mat_id: material ID of the whole mesh
+	*	@error: receives a message on failure
+	*	returns false if the file could not be written
+	*/
+	bool writeClusters(const char* path, int cluster_triangles, int mat_id, string& error) {
+		vector<vec3> scaled(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+			scaled[i] = uniformScale(vertices[i], 50);
+		return write_cluster_file(path, scaled, indices, normals, mat_id, kd, ks, cluster_triangles, error);
 	}
 
 	/*	Prints the vertices array
@@ -147,8 +494,8 @@ class TriMesh {
 	/*	Prints the faces array
 	*/
 	void printFaces() {
-		for (int i = 0; i < faces.size(); i++) {
-			cout << faces[i] << endl;
+		for (int i = 0; i < numFaces; i++) {
+			cout << indices[3*i] + 1 << " " << indices[3*i+1] + 1 << " " << indices[3*i+2] + 1 << endl;
 		}	
 	}
 
@@ -169,13 +516,67 @@ class TriMesh {
 	/*	Gets the size of the faces arra
 	*/
 	int getFacesSize() {
-		return faces.size();	
+		return numFaces;
 	}
 
-	vector<vec3> normals;
+	vector<vec3> normals;			// per vertex, unit length, filled by the loaders
 	vector<vec3> vertices;
+	vector<real> texcoords;			// u, v per "vt" line
+	vector<vec3> file_normals;		// "vn" lines
+	// The per-corner and per-triangle arrays below are empty when the file
+	// has no texture coordinates, normals or materials.
+	vector<int> uv_indices;			// per corner, -1 if absent
+	vector<int> normal_indices;		// per corner, -1 if absent
+	vector<int> face_materials;		// per triangle, into material_names, -1 if none
+	vector<string> material_names;	// usemtl names; generateTriangles maps them to material IDs
+
+	/*	Returns the index of a usemtl name in material_names, -1 if unused
+	*	@name: the material name
+	*/
+	int material_id(const string& name) const {
+		for (size_t i = 0; i < material_names.size(); i++)
+			if (material_names[i] == name) return static_cast<int>(i);
+		return -1;
+	}
+
 	private:
-		vector<vec3> faces;	// length = # of triangles
+		/*	Returns the number of threads to load with: OBJ_LOAD_THREADS, or
+		*	one per hardware thread, but at most max_useful
+		*/
+		static int load_threads(size_t max_useful) {
+			int n = OBJ_LOAD_THREADS > 0 ? OBJ_LOAD_THREADS
+										 : static_cast<int>(std::thread::hardware_concurrency());
+			if (n < 1) n = 1;
+			return static_cast<int>(std::min<size_t>(n, max_useful));
+		}
+
+		/*	Splits [0, n) into one contiguous range per thread and runs
+		*	body(begin, end) on each, the first range on this thread
+		*/
+		template <typename F>
+		static void parallel_for(int threads, size_t n, const F& body) {
+			vector<std::thread> pool;
+			for (int t = 1; t < threads; t++)
+				pool.push_back(std::thread([&body, t, threads, n]() {
+					body(n * t / threads, n * (t + 1) / threads);
+				}));
+			body(0, n / threads);
+			for (size_t i = 0; i < pool.size(); i++)
+				pool[i].join();
+		}
+
+		static uint64_t cell_key(long long x, long long y, long long z) {
+			return (static_cast<uint64_t>(x) * 73856093u) ^ (static_cast<uint64_t>(y) * 19349663u)
+				^ (static_cast<uint64_t>(z) * 83492791u);
+		}
+
+		void ply_truncated() const {
+			cerr << fileName << ": ply data is truncated" << endl;
+			exit(EXIT_FAILURE);
+		}
+
+		vector<int> indices;	// 0-based, 3 per triangle
+		mesh_shading shading;	// what generateTriangles hands to the triangles
 		int numVertices;
 		int numFaces;
 		vec3 kd;
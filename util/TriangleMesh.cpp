@@ -8,51 +8,153 @@
 *	@rec: The hit record to store the info
 *	returns true if ray intersects the triangle, false otherwise
 */
-bool TriangleMesh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-	double epsilon = 1e-5;
+bool TriangleMesh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	real epsilon = 1e-5;
 	vec3 edge1 = v2 - v1;
 	vec3 edge2 = v3 - v1;
-	vec3 n = cross(edge1,edge2);
 	vec3 h = cross(r.direction(),edge2);
-	double a = dot(edge1,h);
+	real a = dot(edge1,h);
 	if (a > -epsilon && a < epsilon) {
 		// ray is parallel to triangle
 		return false;
 	}
 
-	double f = 1.0/a;
+	real f = 1.0/a;
 	vec3 s = r.origin() - v1;
-	double u = f * dot(s,h);
+	real u = f * dot(s,h);
 	if (u < 0 || u > 1) {
 		return false;
 	}
 
 	vec3 q = cross(s,edge1);
-	double v = f * dot(r.direction(),q);
+	real v = f * dot(r.direction(),q);
 	if (v < 0 || u + v > 1) {
 		return false;
 	}
 
-	double t = f * dot(edge2,q);
+	real t = f * dot(edge2,q);
 	if (t < 0 || t < t_min || t_max < t) {
 		return false;
 	}
 	
 	if (t > epsilon) {
-		rec.t = t;
-    	rec.p = r.at(rec.t);
-    	rec.n = normalize(n);
-		rec.kd = kd;
-		rec.ks = ks;
-		rec.v1i = v1i;
-		rec.v2i = v2i;
-		rec.v3i = v3i;
+		fill_record(t, u, v, rec);
 		return true;
 	}
 
 	return false;
 }
 
+/* Moeller-Trumbore for every lane of a ray packet. The tests of hit() are
+*	combined with & into one flag per lane, so the lane loop has no
+*	branches and gcc vectorizes it from -O2 on; the records of the lanes
+*	that hit are filled in afterwards.
+*	@p: ray packet to cast
+*	@t_min: the min t value
+*	@hits: per-lane hit records
+*	@active: the lanes to test
+*/
+void TriangleMesh::hit_packet(const ray_packet& p, real t_min, packet_hits& hits, lane_mask active) const {
+	const real epsilon = 1e-5;
+	const vec3 edge1 = v2 - v1;
+	const vec3 edge2 = v3 - v1;
+	const real e1x = edge1[0], e1y = edge1[1], e1z = edge1[2];
+	const real e2x = edge2[0], e2y = edge2[1], e2z = edge2[2];
+	real ts[PACKET_SIZE], us[PACKET_SIZE], vs[PACKET_SIZE];
+	real found[PACKET_SIZE];
+	for (int i = 0; i < PACKET_SIZE; i++) {
+		real lane_max = hits.t_max[i];
+		real hx = p.dy[i]*e2z - p.dz[i]*e2y;
+		real hy = p.dz[i]*e2x - p.dx[i]*e2z;
+		real hz = p.dx[i]*e2y - p.dy[i]*e2x;
+		real a = e1x*hx + e1y*hy + e1z*hz;
+		real f = 1 / a;
+		real sx = p.ox[i] - v1[0];
+		real sy = p.oy[i] - v1[1];
+		real sz = p.oz[i] - v1[2];
+		real u = f * (sx*hx + sy*hy + sz*hz);
+		real qx = sy*e1z - sz*e1y;
+		real qy = sz*e1x - sx*e1z;
+		real qz = sx*e1y - sy*e1x;
+		real v = f * (p.dx[i]*qx + p.dy[i]*qy + p.dz[i]*qz);
+		real t = f * (e2x*qx + e2y*qy + e2z*qz);
+		ts[i] = t;
+		us[i] = u;
+		vs[i] = v;
+		found[i] = (std::fabs(a) >= epsilon) & (u >= 0) & (u <= 1) & (v >= 0) & (u + v <= 1)
+				 & (t >= t_min) & (t <= lane_max) & (t > epsilon) ? 1 : 0;
+	}
+
+	for (int i = 0; i < PACKET_SIZE; i++) {
+		if (!(active >> i & 1) || found[i] == 0) continue;
+		fill_record(ts[i], us[i], vs[i], hits.rec[i]);
+		hits.t_max[i] = ts[i];
+		hits.hit |= lane_mask(1) << i;
+	}
+}
+
+/* Records a candidate hit. Only t and the barycentrics are stored; the
+*	surface is expanded by get_surface if this hit turns out closest.
+*	@t: t value of the hit
+*	@u, @v: barycentric weights of v2 and v3
+*	@rec: the hit record struct
+*/
+void TriangleMesh::fill_record(real t, real u, real v, hit_record& rec) const {
+	rec.t = t;
+	rec.obj = this;
+	rec.prim_id = 0;
+	rec.b1 = u;
+	rec.b2 = v;
+	rec.mat_id = mat;
+}
+
+/* Computes the hit point, normal and texture coordinates of the closest
+*	hit. The normal is interpolated with the barycentrics from hit(), from
+*	the file's normals where the corners have them and the computed vertex
+*	normals otherwise; without either, or where they cancel out, it is the
+*	geometric normal. It is turned to the geometric normal's side and then
+*	against the ray, and front_face tells which side was hit. The
+*	texture coordinates are interpolated if all three corners have them,
+*	else they are the barycentrics.
+*	@r: Ray that hit the triangle
+*	@rec: The hit record to complete
+*/
+void TriangleMesh::get_surface(const ray& r, hit_record& rec) const {
+	rec.p = r.at(rec.t);
+	vec3 flat = normalize(cross(v2 - v1, v3 - v1));
+	real b0 = 1 - rec.b1 - rec.b2;
+	vec3 n = flat;
+	if (shading) {
+		vec3 sum = b0*corner_normal(0, flat) + rec.b1*corner_normal(1, flat) + rec.b2*corner_normal(2, flat);
+		if (sum.length_squared() > 0)
+			n = normalize(sum);
+		if (dot(n, flat) < 0)
+			n = -n;
+	}
+	rec.front_face = dot(r.direction(), flat) < 0;
+	rec.n = rec.front_face ? n : -n;
+
+	if (shading && shading->texcoords && uv_index[0] >= 0 && uv_index[1] >= 0 && uv_index[2] >= 0) {
+		const real* tc = shading->texcoords;
+		rec.u = b0*tc[2*uv_index[0]] + rec.b1*tc[2*uv_index[1]] + rec.b2*tc[2*uv_index[2]];
+		rec.v = b0*tc[2*uv_index[0]+1] + rec.b1*tc[2*uv_index[1]+1] + rec.b2*tc[2*uv_index[2]+1];
+	} else {
+		rec.u = rec.b1;
+		rec.v = rec.b2;
+	}
+}
+
+/* Returns the shading normal of corner k: the file's normal if the corner
+*	has one, else the computed vertex normal, else flat
+*/
+vec3 TriangleMesh::corner_normal(int k, const vec3& flat) const {
+	if (shading->file_normals && normal_index[k] >= 0)
+		return shading->file_normals[normal_index[k]];
+	if (shading->vertex_normals)
+		return shading->vertex_normals[vertex_index(k) - 1];
+	return flat;
+}
+
 /*	Constructs a bounding box for a triangle.
 *	@time0: t0 time interval for moving objects
 *	@time1: t1 time interval for moving objects
@@ -60,14 +162,14 @@ bool TriangleMesh::hit(const ray& r, double t_min, double t_max, hit_record& rec
 *	Returns an AABB.
 */
 bool TriangleMesh::bounding_box(double time0, double time1, aabb& output_box) const {
-	double minx = fmin(v1[0],fmin(v2[0],v3[0]));
-	double miny = fmin(v1[1],fmin(v2[1],v3[1]));
-	double minz = fmin(v1[2],fmin(v2[2],v3[2]));
+	real minx = fmin(v1[0],fmin(v2[0],v3[0]));
+	real miny = fmin(v1[1],fmin(v2[1],v3[1]));
+	real minz = fmin(v1[2],fmin(v2[2],v3[2]));
 
-	double maxx = fmax(v1[0],fmax(v2[0],v3[0]));
-	double maxy = fmax(v1[1],fmax(v2[1],v3[1]));
-	double maxz = fmax(v1[2],fmax(v2[2],v3[2]));
-	double eps = 1e-5;
+	real maxx = fmax(v1[0],fmax(v2[0],v3[0]));
+	real maxy = fmax(v1[1],fmax(v2[1],v3[1]));
+	real maxz = fmax(v1[2],fmax(v2[2],v3[2]));
+	real eps = 1e-5;
 	
 	vec3 min = vec3(minx-eps,miny-eps,minz-eps);
 	vec3 max = vec3(maxx+eps,maxy+eps,maxz+eps);
@@ -4,15 +4,60 @@
 #include "hittable.h"
 #include "vec3.h"
 
+/*	Shading data a mesh shares with its triangles. Any pointer may be null.
+*	The mesh must outlive its triangles.
+*/
+struct mesh_shading {
+	mesh_shading() : vertex_normals(nullptr), file_normals(nullptr), texcoords(nullptr) {}
+
+	const vec3* vertex_normals;	// computed, indexed by 0-based vertex index
+	const vec3* file_normals;	// from the file, indexed by normal index
+	const real* texcoords;		// u, v pairs, indexed by uv index
+};
+
 class TriangleMesh : public hittable {
 	public:
-		TriangleMesh(vec3 v1u, vec3 v2u, vec3 v3u, vec3 kdu, vec3 ksu, int v1ii, int v2ii, int v3ii)
-		: v1(v1u), v2(v2u), v3(v3u), kd(kdu), ks(ksu), v1i(v1ii), v2i(v2ii), v3i(v3ii) {};
+		/*	@v1u, @v2u, @v3u: the corners, in CCW order
+		*	@kdu, @ksu: phong colors
+		*	@v1ii, @v2ii, @v3ii: 1-based mesh indices of the corners
+		*	@shadingu: the mesh's normals and texture coordinates, or null for
+		*		flat shading
+		*	@matu: material ID
+		*/
+		TriangleMesh(vec3 v1u, vec3 v2u, vec3 v3u, vec3 kdu, vec3 ksu, int v1ii, int v2ii, int v3ii,
+					 const mesh_shading* shadingu = nullptr, int matu = -1)
+		: v1(v1u), v2(v2u), v3(v3u), kd(kdu), ks(ksu), v1i(v1ii), v2i(v2ii), v3i(v3ii),
+		  shading(shadingu), mat(matu) {
+			for (int k = 0; k < 3; k++)
+				normal_index[k] = uv_index[k] = -1;
+		}
+
+		/*	Sets the per-corner indices into the file's normals and texture
+		*	coordinates, -1 where a corner has none
+		*/
+		void set_corners(const int* normals, const int* uvs) {
+			for (int k = 0; k < 3; k++) {
+				normal_index[k] = normals ? normals[k] : -1;
+				uv_index[k] = uvs ? uvs[k] : -1;
+			}
+		}
 
 		virtual bool hit(
-            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+            const ray& r, real t_min, real t_max, hit_record& rec) const override;
 		virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+		virtual void hit_packet(
+			const ray_packet& p, real t_min, packet_hits& hits, lane_mask active) const override;
+		virtual void get_surface(const ray& r, hit_record& rec) const override;
+		virtual vec3 phong_kd() const override { return kd; }
+		virtual vec3 phong_ks() const override { return ks; }
+
+		/*	Returns the 1-based mesh index of vertex 1, 2 or 3
+		*/
+		int vertex_index(int i) const { return (i == 0) ? v1i : (i == 1) ? v2i : v3i; }
 	private:
+		void fill_record(real t, real u, real v, hit_record& rec) const;
+		vec3 corner_normal(int k, const vec3& flat) const;
+
 		vec3 v1;
 		vec3 v2;
 		vec3 v3;
@@ -21,5 +66,9 @@ class TriangleMesh : public hittable {
 		int v1i;
 		int v2i;
 		int v3i;
+		const mesh_shading* shading;	// null if flat
+		int normal_index[3];			// into shading->file_normals, -1 if none
+		int uv_index[3];				// into shading->texcoords, -1 if none
+		int mat;
 };
 #endif
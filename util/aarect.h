@@ -9,8 +9,8 @@ class xy_rect : public hittable {
     public:
         xy_rect() {}
 
-        xy_rect(double _x0, double _x1, double _y0, double _y1, double _k, 
-            shared_ptr<material> mat)
+        xy_rect(real _x0, real _x1, real _y0, real _y1, real _k, 
+            int mat)
             : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
 
 		/*	Determines whether ray hits the rect
@@ -20,7 +20,23 @@ class xy_rect : public hittable {
 		*	@rec: the hit record struct
 		*	returns true if sphere intersects ray
 		*/
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+
+		/*	Computes the hit point, normal and uv of the closest hit
+		*	@r: the ray that hit the rect
+		*	@rec: the hit record struct
+		*/
+		virtual void get_surface(const ray& r, hit_record& rec) const override;
+
+		/*	Picks a uniformly distributed point on the rect
+		*	@o: the point being lit
+		*	@u1, @u2: uniform numbers that choose the point
+		*	@pdf: receives the density per solid angle
+		*	returns the direction from o to the point
+		*/
+		virtual vec3 sample(const vec3& o, real u1, real u2, real& pdf) const override;
+		virtual real pdf(const vec3& o, const vec3& dir) const override;
+		virtual real area() const override { return (x1-x0) * (y1-y0); }
 
 		/*	Constructs a bounding box for a sphere.
 		*	@time0: t0 time interval for moving objects
@@ -36,8 +52,8 @@ class xy_rect : public hittable {
         }
 
     public:
-        shared_ptr<material> mp;
-        double x0, x1, y0, y1, k;
+        int mp;
+        real x0, x1, y0, y1, k;
 };
 
 /*	Hit function for xy_rect
@@ -47,7 +63,7 @@ class xy_rect : public hittable {
 *	@rec: hit record of point
 *	returns true if hit, false otherwise
 */
-bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool xy_rect::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     auto t = (k-r.origin().z()) / r.direction().z();
     if (t < t_min || t > t_max)
         return false;
@@ -55,14 +71,43 @@ bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     auto y = r.origin().y() + t*r.direction().y();
     if (x < x0 || x > x1 || y < y0 || y > y1)
         return false;
-    rec.u = (x-x0)/(x1-x0);
-    rec.v = (y-y0)/(y1-y0);
     rec.t = t;
+    rec.obj = this;
+    rec.prim_id = 0;
+    rec.mat_id = mp;
+    return true;
+}
+
+/*	Surface expansion for xy_rect
+*	@r: the ray that hit the rect
+*	@rec: hit record of point
+*/
+void xy_rect::get_surface(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+    rec.u = (rec.p.x()-x0)/(x1-x0);
+    rec.v = (rec.p.y()-y0)/(y1-y0);
     auto outward_normal = vec3(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-    return true;
+}
+
+/*	The area density 1/A turned into a density per solid angle at o:
+*	dist^2 / (|cos| A). Both faces of the rect emit.
+*/
+vec3 xy_rect::sample(const vec3& o, real u1, real u2, real& pdf) const {
+    vec3 dir = vec3(x0 + u1*(x1-x0), y0 + u2*(y1-y0), k) - o;
+    real dist_squared = dir.length_squared();
+    real cosine = std::fabs(dir.z()) / std::sqrt(dist_squared);
+    pdf = cosine > 0 ? dist_squared / (cosine * (x1-x0) * (y1-y0)) : 0;
+    return dir;
+}
+
+real xy_rect::pdf(const vec3& o, const vec3& dir) const {
+    hit_record rec;
+    if (!hit(ray(o, dir), 0.001, infinity, rec))
+        return 0;
+    real dist_squared = rec.t * rec.t * dir.length_squared();
+    real cosine = std::fabs(dir.z()) / dir.length();
+    return dist_squared / (cosine * (x1-x0) * (y1-y0));
 }
 
 #endif
@@ -0,0 +1,139 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <memory>
+#include <new>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using std::shared_ptr;
+using std::make_shared;
+
+/*	Base class so an arena can own pools of different types.
+*/
+class pool_base {
+	public:
+		virtual ~pool_base() {}
+		virtual size_t size() const = 0;
+		virtual size_t bytes() const = 0;
+};
+
+/*	Stores objects of one type back to back in fixed-size chunks. Objects
+*	are never freed one at a time; they are all destroyed with the pool.
+*/
+template <typename T>
+class pool : public pool_base {
+	public:
+		explicit pool(size_t chunk = 4096) : chunk_size(chunk), used(chunk) {}
+
+		~pool() {
+			for (size_t c = 0; c < chunks.size(); c++) {
+				size_t n = (c + 1 == chunks.size()) ? used : chunk_size;
+				for (size_t i = 0; i < n; i++)
+					chunks[c][i].~T();
+				::operator delete(chunks[c]);
+			}
+		}
+
+		/*	Constructs a T in the next free slot
+		*	@args: arguments forwarded to the constructor of T
+		*	returns a pointer to the new object
+		*/
+		template <typename... Args>
+		T* create(Args&&... args) {
+			if (used == chunk_size) {
+				chunks.push_back(static_cast<T*>(::operator new(chunk_size * sizeof(T))));
+				used = 0;
+			}
+			// Claim the slot before constructing: a constructor may itself
+			// allocate from this pool (bvh_node building its children).
+			T* p = chunks.back() + used++;
+			new (p) T(std::forward<Args>(args)...);
+			return p;
+		}
+
+		virtual size_t size() const override {
+			return chunks.empty() ? 0 : (chunks.size() - 1) * chunk_size + used;
+		}
+
+		virtual size_t bytes() const override {
+			return chunks.size() * chunk_size * sizeof(T);
+		}
+
+	private:
+		std::vector<T*> chunks;
+		size_t chunk_size;
+		size_t used;
+};
+
+/*	Scene arena: primitives and BVH nodes are placed in one typed pool per
+*	class instead of one heap block plus control block each, and
+*	everything is freed in bulk when the arena is destroyed. Textures and
+*	materials are not pooled.
+*
+*	make() hands out shared_ptr handles that do not own anything (they alias
+*	an empty shared_ptr), so they fit every interface that takes a
+*	shared_ptr<hittable> and copying them touches no reference count. The
+*	arena must outlive every handle it gave out: declare it before the scene.
+*/
+class arena {
+	public:
+		arena() {}
+		arena(const arena&) = delete;
+		arena& operator=(const arena&) = delete;
+
+		/*	Constructs a T in the arena
+		*	@args: arguments forwarded to the constructor of T
+		*	returns a non-owning handle to the object
+		*/
+		template <typename T, typename... Args>
+		shared_ptr<T> make(Args&&... args) {
+			T* p = get_pool<T>().create(std::forward<Args>(args)...);
+			return shared_ptr<T>(shared_ptr<T>(), p);
+		}
+
+		/*	Returns the number of objects in the arena
+		*/
+		size_t size() const {
+			size_t n = 0;
+			for (const auto& p : pools)
+				n += p.second->size();
+			return n;
+		}
+
+		/*	Returns the number of bytes reserved by the arena
+		*/
+		size_t bytes() const {
+			size_t n = 0;
+			for (const auto& p : pools)
+				n += p.second->bytes();
+			return n;
+		}
+
+	private:
+		template <typename T>
+		pool<T>& get_pool() {
+			std::unique_ptr<pool_base>& slot = pools[std::type_index(typeid(T))];
+			if (!slot)
+				slot.reset(new pool<T>());
+			return static_cast<pool<T>&>(*slot);
+		}
+
+		std::unordered_map<std::type_index, std::unique_ptr<pool_base>> pools;
+};
+
+/*	Allocates a T in mem, or on the heap with make_shared when mem is null.
+*	Lets builders take an optional arena without duplicating every call.
+*	@mem: the arena, may be null
+*	@args: arguments forwarded to the constructor of T
+*/
+template <typename T, typename... Args>
+shared_ptr<T> make_in(arena* mem, Args&&... args) {
+	if (mem)
+		return mem->make<T>(std::forward<Args>(args)...);
+	return make_shared<T>(std::forward<Args>(args)...);
+}
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "arena.h"
 #include <algorithm>
 
 
@@ -12,16 +13,26 @@ class bvh_node : public hittable {
     public:
         bvh_node();
 
-        bvh_node(const hittable_list& list, double time0, double time1, int k)
-            : bvh_node(list.objects, 0, list.objects.size(), time0, time1, k)
+        bvh_node(const hittable_list& list, double time0, double time1, int k, arena* mem = nullptr)
+            : bvh_node(list.objects, 0, list.objects.size(), time0, time1, k, mem)
         {}
 
         bvh_node(
             const std::vector<shared_ptr<hittable>>& src_objects,
-            size_t start, size_t end, double time0, double time1, int k);
+            size_t start, size_t end, double time0, double time1, int k, arena* mem = nullptr);
+
+		// Builds the subtree over (*objects)[start, end), sorting that range
+		// in place. Used for the child nodes so the object array is copied
+		// once per build rather than once per node.
+		bvh_node(
+			std::vector<shared_ptr<hittable>>* objects,
+			size_t start, size_t end, double time0, double time1, int k, arena* mem);
 
         virtual bool hit(
-            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+            const ray& r, real t_min, real t_max, hit_record& rec) const override;
+
+		virtual void hit_packet(
+			const ray_packet& p, real t_min, packet_hits& hits, lane_mask active) const override;
 
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
@@ -30,6 +41,7 @@ class bvh_node : public hittable {
         shared_ptr<hittable> right;
         aabb box;
 		int k;
+		int split_axis;		// left holds the lower boxes along this axis
 };
 
 /*	Constructs a bounding box for a BVH.
@@ -50,7 +62,7 @@ bool bvh_node::bounding_box(double time0, double time1, aabb& output_box) const
 *	@rec: hit record to store the data
 *	Returns true if ray hits BVH, false otherwise.
 */
-bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool bvh_node::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
 	//std::cout << "first here" << std::endl;    
 	if (!box.hit(r, t_min, t_max))
         return false;
@@ -61,6 +73,33 @@ bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
     return hit_left || hit_right;
 }
 
+/*	Traverses the BVH with a whole ray packet. A node is visited once for
+*	all lanes that hit its box, so coherent camera rays share the traversal.
+*	The child that comes first along the packet's direction is visited
+*	first, so its hits shrink t_max before the other child's box is tested.
+*	@p: Ray packet to test
+*	@t_min: min value of t
+*	@hits: per-lane hit records, t_max shrinks as closer hits are found
+*	@active: the lanes to test
+*/
+void bvh_node::hit_packet(const ray_packet& p, real t_min, packet_hits& hits, lane_mask active) const {
+	lane_mask m = box.hit_packet(p, t_min, hits.t_max, active);
+	if (!m)
+		return;
+
+	if (right == left) {
+		left->hit_packet(p, t_min, hits, m);
+		return;
+	}
+	// The packet is coherent, so one lane's direction stands for all.
+	int lane = first_lane(m);
+	real d = split_axis == 0 ? p.dx[lane] : split_axis == 1 ? p.dy[lane] : p.dz[lane];
+	const hittable* near = d < 0 ? right.get() : left.get();
+	const hittable* far = d < 0 ? left.get() : right.get();
+	near->hit_packet(p, t_min, hits, m);
+	far->hit_packet(p, t_min, hits, m);
+}
+
 /* Used to sort boxes based on an axis
 *	@a: The first box
 *	@b: The second box
@@ -101,17 +140,33 @@ bool box_z_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b)
 *	@time0: t0 for moving objects
 *	@time1: t1 for moving objects
 *	@k: max depth to recurse
+*	@mem: arena to place the nodes in, or null to use the heap
 */
-bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end, double time0, double time1, int k) {
+bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end, double time0, double time1, int k, arena* mem) {
     auto objects = src_objects; // Create a modifiable array of the source scene objects
+	*this = bvh_node(&objects, start, end, time0, time1, k, mem);
+}
+
+/*	Constructor for BVH that sorts the objects in place
+*	@objects: The objects in the world, reordered by the build
+*	@start: the index to start at (inclusive)
+*	@end: The index to end at (exclusive)
+*	@time0: t0 for moving objects
+*	@time1: t1 for moving objects
+*	@k: max depth to recurse
+*	@mem: arena to place the nodes in, or null to use the heap
+*/
+bvh_node::bvh_node(std::vector<shared_ptr<hittable>>* objects_ptr, size_t start, size_t end, double time0, double time1, int k, arena* mem) {
+	std::vector<shared_ptr<hittable>>& objects = *objects_ptr;
 	if (k <= 0) {
 		// we've reached the max depth, stop recursing
+		split_axis = 0;
 		aabb box_left, box_right;
 		if (start == end-1) {
 			left = right = objects[start];
 		} else {
-			left = make_shared<hittable_list>(objects, start, end-1);
-			right = make_shared<hittable_list>(objects,end-1,end);
+			left = make_in<hittable_list>(mem, objects, start, end-1);
+			right = make_in<hittable_list>(mem, objects, end-1, end);
 		}
 		if (  !left->bounding_box (time0, time1, box_left) || !right->bounding_box(time0, time1, box_right))
         	std::cerr << "No bounding box in bvh_node constructor.\n";
@@ -121,6 +176,7 @@ bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t
 	}
 
     int axis = random_int(0,2);
+	split_axis = axis;
     auto comparator = (axis == 0) ? box_x_compare
                     : (axis == 1) ? box_y_compare
                                   : box_z_compare;
@@ -142,8 +198,8 @@ bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t
         std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
         auto mid = start + object_span/2;
-        left = make_shared<bvh_node>(objects, start, mid, time0, time1, k-1);
-        right = make_shared<bvh_node>(objects, mid, end, time0, time1, k-1);
+        left = make_in<bvh_node>(mem, objects_ptr, start, mid, time0, time1, k-1, mem);
+        right = make_in<bvh_node>(mem, objects_ptr, mid, end, time0, time1, k-1, mem);
     }
 
     aabb box_left, box_right;
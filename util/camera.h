@@ -27,8 +27,7 @@ class camera {
 		*	@y: y direction
 		*/
         ray get_ray(double x, double y) const {
-			vec3 vd = viewdir;
-            const vec3 w = -vd/vd.length();
+            const vec3 w = -viewdir/viewdir.length();
 			const vec3 u = (cross(up,w))/(cross(up,w)).length();
 			const vec3 v = cross(w,u);
 			double z = -d;
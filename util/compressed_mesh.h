@@ -0,0 +1,454 @@
+#ifndef COMPRESSED_MESH_H
+#define COMPRESSED_MESH_H
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+#include "util.h"
+#include "hittable.h"
+
+// Triangles per BVH leaf of a compressed_mesh.
+#ifndef COMPRESSED_MESH_LEAF
+#define COMPRESSED_MESH_LEAF 8
+#endif
+
+/*	A triangle mesh kept in compact form for very large assets: positions are
+*	quantized to 16 bits per axis over the mesh bounds (6 bytes instead of 24
+*	in double, 12 in float), vertex normals are octahedron-encoded in two
+*	16-bit values, and the triangles are plain index triples in BVH leaf
+*	order. Vertices are decoded inside the intersection kernel, so the whole
+*	mesh is one hittable with no per-triangle object. The maximum position
+*	error is half a quantization step, extent / 131070 along each axis;
+*	shared vertices decode to the same point, so the mesh stays watertight.
+*	The triangle index is stored in rec.prim_id.
+*/
+class compressed_mesh : public hittable {
+	public:
+		/*	Quantizes the mesh and builds its BVH
+		*	@positions: vertex positions
+		*	@indices: 0-based vertex indices, 3 per triangle
+		*	@vertex_normals: unit normal per vertex, or empty for flat shading
+		*	@mat_id: material ID of the whole mesh
+		*	@kdu, @ksu: phong colors
+		*/
+		compressed_mesh(const std::vector<vec3>& positions, const std::vector<int>& indices,
+						const std::vector<vec3>& vertex_normals, int mat_id,
+						vec3 kdu = vec3(0,0,0), vec3 ksu = vec3(0,0,0));
+
+		virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+		virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+		virtual void get_surface(const ray& r, hit_record& rec) const override;
+		virtual vec3 phong_kd() const override { return kd; }
+		virtual vec3 phong_ks() const override { return ks; }
+
+		/*	Returns the decoded position of vertex i
+		*/
+		vec3 position(int i) const {
+			const qvertex& q = qpos[i];
+			return vec3(origin[0] + q.x * scale[0], origin[1] + q.y * scale[1], origin[2] + q.z * scale[2]);
+		}
+
+		/*	Returns the decoded normal of vertex i
+		*/
+		vec3 normal(int i) const;
+
+		size_t vertex_count() const { return qpos.size(); }
+		size_t triangle_count() const { return tris.size() / 3; }
+
+		/*	Returns the bytes of vertex and triangle data
+		*/
+		size_t geometry_bytes() const {
+			return qpos.size() * sizeof(qvertex) + qnormal.size() * sizeof(qnorm) + tris.size() * sizeof(int);
+		}
+
+		/*	Returns the bytes of the BVH
+		*/
+		size_t bvh_bytes() const { return nodes.size() * sizeof(node); }
+
+		void serialize(std::vector<char>& out) const;
+		static shared_ptr<compressed_mesh> deserialize(const char* p, size_t size);
+
+	private:
+		compressed_mesh() {}
+
+		struct qvertex { uint16_t x, y, z; };
+		struct qnorm { int16_t u, v; };
+
+		// Flat BVH node, laid out as in sphere_set: the left child of an
+		// interior node is the next node and index is the right child; a
+		// leaf holds count triangles starting at triangle index.
+		struct node {
+			aabb box;
+			int index;
+			int count;		// 0 for interior nodes
+		};
+
+		void build_node(std::vector<int>& order, const std::vector<vec3>& centroid, int start, int end);
+
+		std::vector<qvertex> qpos;
+		std::vector<qnorm> qnormal;		// empty for flat shading
+		std::vector<int> tris;			// 3 vertex indices per triangle, in leaf order
+		std::vector<node> nodes;
+		vec3 origin;					// position of quantized (0, 0, 0)
+		vec3 scale;						// size of one quantization step per axis
+		int mat;
+		vec3 kd;
+		vec3 ks;
+};
+
+/*	Octahedral encoding: folds the unit sphere onto [-1, 1]^2. A zero
+*	normal (e.g. a vertex only used by degenerate triangles) has no
+*	direction and is stored as +z.
+*/
+inline void oct_encode(const vec3& n, int16_t& u, int16_t& v) {
+	real l1 = std::fabs(n[0]) + std::fabs(n[1]) + std::fabs(n[2]);
+	if (l1 == 0) {
+		u = 0;
+		v = 0;
+		return;
+	}
+	real x = n[0] / l1, y = n[1] / l1;
+	if (n[2] < 0) {
+		real fx = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+		real fy = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+		x = fx;
+		y = fy;
+	}
+	u = static_cast<int16_t>(std::lround(std::min(std::max(x, real(-1)), real(1)) * 32767));
+	v = static_cast<int16_t>(std::lround(std::min(std::max(y, real(-1)), real(1)) * 32767));
+}
+
+inline vec3 oct_decode(int16_t u, int16_t v) {
+	real x = u / real(32767), y = v / real(32767);
+	real z = 1 - std::fabs(x) - std::fabs(y);
+	if (z < 0) {
+		real fx = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+		real fy = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+		x = fx;
+		y = fy;
+	}
+	return normalize(vec3(x, y, z));
+}
+
+vec3 compressed_mesh::normal(int i) const {
+	return oct_decode(qnormal[i].u, qnormal[i].v);
+}
+
+compressed_mesh::compressed_mesh(const std::vector<vec3>& positions, const std::vector<int>& indices,
+								 const std::vector<vec3>& vertex_normals, int mat_id, vec3 kdu, vec3 ksu)
+	: mat(mat_id), kd(kdu), ks(ksu) {
+	vec3 lo(infinity, infinity, infinity), hi(-infinity, -infinity, -infinity);
+	for (size_t i = 0; i < positions.size(); i++)
+		for (int a = 0; a < 3; a++) {
+			lo[a] = std::min(lo[a], positions[i][a]);
+			hi[a] = std::max(hi[a], positions[i][a]);
+		}
+	origin = lo;
+	for (int a = 0; a < 3; a++)
+		scale[a] = (hi[a] > lo[a]) ? (hi[a] - lo[a]) / 65535 : 0;
+
+	// Vertices are renumbered in order of first use by the BVH leaves, so
+	// the corners of nearby triangles sit close together in memory.
+	std::vector<int> order(indices.size() / 3);
+	std::vector<vec3> centroid(order.size());
+	for (size_t f = 0; f < order.size(); f++) {
+		order[f] = static_cast<int>(f);
+		centroid[f] = (positions[indices[3*f]] + positions[indices[3*f+1]] + positions[indices[3*f+2]]) / 3;
+	}
+	std::vector<int> remap(positions.size(), -1);
+	std::vector<int> used;
+	tris.resize(indices.size());
+	if (!order.empty()) {
+		nodes.reserve(2 * order.size() / COMPRESSED_MESH_LEAF + 1);
+		build_node(order, centroid, 0, static_cast<int>(order.size()));
+		for (size_t f = 0; f < order.size(); f++)
+			for (int k = 0; k < 3; k++) {
+				int v = indices[3 * order[f] + k];
+				if (remap[v] < 0) {
+					remap[v] = static_cast<int>(used.size());
+					used.push_back(v);
+				}
+				tris[3*f + k] = remap[v];
+			}
+	}
+
+	qpos.resize(used.size());
+	for (size_t i = 0; i < used.size(); i++) {
+		const vec3& p = positions[used[i]];
+		uint16_t q[3];
+		for (int a = 0; a < 3; a++)
+			q[a] = scale[a] > 0 ? static_cast<uint16_t>(std::lround((p[a] - lo[a]) / scale[a])) : 0;
+		qpos[i].x = q[0];
+		qpos[i].y = q[1];
+		qpos[i].z = q[2];
+	}
+	if (!vertex_normals.empty()) {
+		qnormal.resize(used.size());
+		for (size_t i = 0; i < used.size(); i++)
+			oct_encode(vertex_normals[used[i]], qnormal[i].u, qnormal[i].v);
+	}
+
+	// Node boxes are fitted bottom-up to the decoded positions, which are
+	// what hit() intersects, so quantization can never cull a hit.
+	const real eps = 1e-5;
+	for (size_t n = nodes.size(); n-- > 0;) {
+		if (nodes[n].count == 0) {
+			nodes[n].box = surrounding_box(nodes[n + 1].box, nodes[nodes[n].index].box);
+			continue;
+		}
+		vec3 bmin(infinity, infinity, infinity), bmax(-infinity, -infinity, -infinity);
+		for (int f = nodes[n].index; f < nodes[n].index + nodes[n].count; f++)
+			for (int k = 0; k < 3; k++) {
+				vec3 p = position(tris[3*f + k]);
+				for (int a = 0; a < 3; a++) {
+					bmin[a] = std::min(bmin[a], p[a] - eps);
+					bmax[a] = std::max(bmax[a], p[a] + eps);
+				}
+			}
+		nodes[n].box = aabb(bmin, bmax);
+	}
+}
+
+/*	Recursively builds the subtree over order[start, end), splitting at the
+*	median centroid along the widest axis.
+*	@order: triangle indices, partitioned in place
+*	@centroid: triangle centroids
+*	@start: first index in order
+*	@end: one past the last index in order
+*/
+void compressed_mesh::build_node(std::vector<int>& order, const std::vector<vec3>& centroid, int start, int end) {
+	int self = static_cast<int>(nodes.size());
+	nodes.push_back(node());
+
+	if (end - start <= COMPRESSED_MESH_LEAF) {
+		nodes[self].index = start;
+		nodes[self].count = end - start;
+		return;
+	}
+
+	vec3 cmin = centroid[order[start]], cmax = cmin;
+	for (int i = start + 1; i < end; i++)
+		for (int a = 0; a < 3; a++) {
+			cmin[a] = std::min(cmin[a], centroid[order[i]][a]);
+			cmax[a] = std::max(cmax[a], centroid[order[i]][a]);
+		}
+	vec3 extent = cmax - cmin;
+	int axis = 0;
+	if (extent[1] > extent[axis]) axis = 1;
+	if (extent[2] > extent[axis]) axis = 2;
+
+	int mid = start + (end - start) / 2;
+	std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+		[&centroid, axis](int a, int b) { return centroid[a][axis] < centroid[b][axis]; });
+
+	nodes[self].count = 0;
+	build_node(order, centroid, start, mid);
+	nodes[self].index = static_cast<int>(nodes.size());
+	build_node(order, centroid, mid, end);
+}
+
+/*	Determines whether the ray hits any triangle of the mesh. The BVH is
+*	walked with an explicit stack and each leaf triangle is decoded and
+*	tested with Moeller-Trumbore, as in TriangleMesh.
+*	@r: ray to cast
+*	@t_min: the min t value
+*	@t_max: the max t value
+*	@rec: the hit record struct
+*	returns true if a triangle intersects the ray
+*/
+bool compressed_mesh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	if (nodes.empty())
+		return false;
+
+	const real epsilon = 1e-5;
+	const vec3 o = r.origin();
+	const vec3 d = r.direction();
+	int best = -1;
+	real best_u = 0, best_v = 0;
+
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const node& n = nodes[stack[--top]];
+		if (!n.box.hit(r, t_min, t_max))
+			continue;
+
+		if (n.count == 0) {
+			stack[top++] = n.index;
+			stack[top++] = static_cast<int>(&n - &nodes[0]) + 1;
+			continue;
+		}
+
+		for (int f = n.index; f < n.index + n.count; f++) {
+			vec3 v1 = position(tris[3*f]);
+			vec3 edge1 = position(tris[3*f+1]) - v1;
+			vec3 edge2 = position(tris[3*f+2]) - v1;
+			vec3 h = cross(d, edge2);
+			real a = dot(edge1, h);
+			if (a > -epsilon && a < epsilon)
+				continue;
+			real inv = 1 / a;
+			vec3 s = o - v1;
+			real u = inv * dot(s, h);
+			if (u < 0 || u > 1)
+				continue;
+			vec3 q = cross(s, edge1);
+			real v = inv * dot(d, q);
+			if (v < 0 || u + v > 1)
+				continue;
+			real t = inv * dot(edge2, q);
+			if (t > epsilon && t > t_min && t < t_max) {
+				t_max = t;
+				best = f;
+				best_u = u;
+				best_v = v;
+			}
+		}
+	}
+
+	if (best < 0)
+		return false;
+
+	rec.t = t_max;
+	rec.obj = this;
+	rec.prim_id = best;
+	rec.b1 = best_u;
+	rec.b2 = best_v;
+	rec.mat_id = mat;
+	return true;
+}
+
+/*	Computes the hit point and normal of the closest hit. The normal is the
+*	interpolated vertex normal when the mesh has them, oriented against the
+*	ray like the geometric normal; where the vertex normals cancel out it
+*	is the geometric normal.
+*	@r: the ray that hit the mesh
+*	@rec: the hit record struct, rec.prim_id is the triangle
+*/
+void compressed_mesh::get_surface(const ray& r, hit_record& rec) const {
+	const int f = rec.prim_id;
+	vec3 v1 = position(tris[3*f]);
+	vec3 geometric = normalize(cross(position(tris[3*f+1]) - v1, position(tris[3*f+2]) - v1));
+	vec3 shading = geometric;
+	if (!qnormal.empty()) {
+		real b0 = 1 - rec.b1 - rec.b2;
+		vec3 n = b0*normal(tris[3*f]) + rec.b1*normal(tris[3*f+1]) + rec.b2*normal(tris[3*f+2]);
+		if (n.length_squared() > 0)
+			shading = normalize(n);
+	}
+	if (dot(shading, geometric) < 0)
+		shading = -shading;
+	rec.p = r.at(rec.t);
+	rec.front_face = dot(r.direction(), geometric) < 0;
+	rec.n = rec.front_face ? shading : -shading;
+	rec.u = rec.b1;
+	rec.v = rec.b2;
+}
+
+// Leading fields of a serialized compressed_mesh; the arrays follow in
+// the order qpos, qnormal, tris, nodes. Raw structs are written, so a blob
+// is only read back by a build with the same real and vec3 layout.
+struct compressed_mesh_blob {
+	uint32_t real_size;
+	uint32_t node_size;
+	uint32_t vertices;
+	uint32_t normals;
+	uint32_t indices;
+	uint32_t nodes;
+	int32_t mat;
+	real origin[3];
+	real scale[3];
+	real kd[3];
+	real ks[3];
+};
+
+/*	Appends the mesh to out as one contiguous blob
+*	@out: the buffer to append to
+*/
+void compressed_mesh::serialize(std::vector<char>& out) const {
+	compressed_mesh_blob h;
+	memset(&h, 0, sizeof(h));
+	h.real_size = sizeof(real);
+	h.node_size = sizeof(node);
+	h.vertices = static_cast<uint32_t>(qpos.size());
+	h.normals = static_cast<uint32_t>(qnormal.size());
+	h.indices = static_cast<uint32_t>(tris.size());
+	h.nodes = static_cast<uint32_t>(nodes.size());
+	h.mat = mat;
+	for (int a = 0; a < 3; a++) {
+		h.origin[a] = origin[a];
+		h.scale[a] = scale[a];
+		h.kd[a] = kd[a];
+		h.ks[a] = ks[a];
+	}
+	size_t at = out.size();
+	out.resize(at + sizeof(h) + geometry_bytes() + bvh_bytes());
+	char* p = &out[at];
+	memcpy(p, &h, sizeof(h));
+	p += sizeof(h);
+	memcpy(p, qpos.data(), qpos.size() * sizeof(qvertex));
+	p += qpos.size() * sizeof(qvertex);
+	memcpy(p, qnormal.data(), qnormal.size() * sizeof(qnorm));
+	p += qnormal.size() * sizeof(qnorm);
+	memcpy(p, tris.data(), tris.size() * sizeof(int));
+	p += tris.size() * sizeof(int);
+	memcpy(p, nodes.data(), nodes.size() * sizeof(node));
+}
+
+/*	Reads a mesh written by serialize()
+*	@p: start of the blob
+*	@size: bytes available at p
+*	returns the mesh, or null if the blob is short or from another layout
+*/
+shared_ptr<compressed_mesh> compressed_mesh::deserialize(const char* p, size_t size) {
+	compressed_mesh_blob h;
+	if (size < sizeof(h))
+		return nullptr;
+	memcpy(&h, p, sizeof(h));
+	if (h.real_size != sizeof(real) || h.node_size != sizeof(node))
+		return nullptr;
+	size_t need = sizeof(h) + size_t(h.vertices) * sizeof(qvertex) + size_t(h.normals) * sizeof(qnorm)
+		+ size_t(h.indices) * sizeof(int) + size_t(h.nodes) * sizeof(node);
+	if (size < need)
+		return nullptr;
+
+	shared_ptr<compressed_mesh> m(new compressed_mesh());
+	m->mat = h.mat;
+	for (int a = 0; a < 3; a++) {
+		m->origin[a] = h.origin[a];
+		m->scale[a] = h.scale[a];
+		m->kd[a] = h.kd[a];
+		m->ks[a] = h.ks[a];
+	}
+	p += sizeof(h);
+	m->qpos.resize(h.vertices);
+	m->qnormal.resize(h.normals);
+	m->tris.resize(h.indices);
+	m->nodes.resize(h.nodes);
+	memcpy(m->qpos.data(), p, h.vertices * sizeof(qvertex));
+	p += h.vertices * sizeof(qvertex);
+	memcpy(m->qnormal.data(), p, h.normals * sizeof(qnorm));
+	p += h.normals * sizeof(qnorm);
+	memcpy(m->tris.data(), p, h.indices * sizeof(int));
+	p += h.indices * sizeof(int);
+	memcpy(m->nodes.data(), p, h.nodes * sizeof(node));
+	return m;
+}
+
+/*	Returns the bounding box of the whole mesh.
+*	@time0: t0 time interval for moving objects
+*	@time1: t1 time interval for moving objects
+*	@output_box: output bounding box
+*	Returns false if the mesh has no triangles.
+*/
+bool compressed_mesh::bounding_box(double time0, double time1, aabb& output_box) const {
+	if (nodes.empty())
+		return false;
+	output_box = nodes[0].box;
+	return true;
+}
+
+#endif
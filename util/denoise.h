@@ -0,0 +1,333 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "util.h"
+#include "framebuffer.h"
+#include "material.h"
+
+// Threads the denoiser runs on, 0 means one per hardware thread.
+#ifndef DENOISE_THREADS
+#define DENOISE_THREADS 0
+#endif
+
+// À-Trous passes; pass i samples every 2^i-th pixel, so 3 passes reach a
+// 29 x 29 pixel footprint.
+#ifndef DENOISE_ITERATIONS
+#define DENOISE_ITERATIONS 3
+#endif
+
+/*	What the camera ray of one sample saw, the guide for the denoiser.
+*	Mirrors and glass show other surfaces, so the features are taken from
+*	the first diffuse surface or light along the path (see record_hit).
+*	Misses have normal and depth 0.
+*/
+struct pixel_features {
+	pixel_features() : albedo(1,1,1), normal(0,0,0), depth(0), emitter(0) {}
+
+	vec3 albedo;	// reflectance of the surface times the specular tints before it
+	vec3 normal;	// the shading normal, facing the ray
+	real depth;		// length of the path to the surface
+	real emitter;	// 1 if the surface is a light
+};
+
+/*	Adds one hit of a camera path to its features
+*	@f: the features, start from pixel_features()
+*	@m: the material that was hit
+*	@rec: the hit, with its surface
+*	@distance: length of the ray segment to the hit
+*	returns true if the hit was specular and the next hit must be recorded too
+*/
+inline bool record_hit(pixel_features& f, const material& m, const hit_record& rec, real distance) {
+	f.depth += distance;
+	if (m.type == METAL || m.type == DIELECTRIC) {
+		f.albedo = f.albedo * m.albedo;
+		return true;
+	}
+	if (m.type == LAMBERTIAN)
+		f.albedo = f.albedo * m.color(rec.u, rec.v, rec.p);
+	if (m.type == DIFFUSE_LIGHT)
+		f.emitter = 1;
+	f.normal = rec.n;
+	return false;
+}
+
+/*	Ends the features of a camera path that left the scene
+*	@f: the features
+*/
+inline void record_miss(pixel_features& f) {
+	f.normal = vec3(0,0,0);
+	f.depth = 0;
+}
+
+/*	Luminance of a color
+*/
+inline float luminance(const vec3& c) {
+	return static_cast<float>(0.2126 * c[0] + 0.7152 * c[1] + 0.0722 * c[2]);
+}
+
+/*	Per-pixel averages of the first-hit features of every sample, in the
+*	pixel order of a framebuffer (j * width + i), and the first two
+*	moments of the luminance of the samples' lighting (their color divided
+*	by their albedo), from which the denoiser estimates each pixel's noise
+*	as SVGF does.
+*/
+struct feature_buffers {
+	feature_buffers() : samples(1) {}
+	feature_buffers(int w, int h) : samples(1) { reset(w, h); }
+
+	/*	Resizes the buffers and clears them
+	*/
+	void reset(int w, int h) {
+		const size_t n = static_cast<size_t>(w) * h;
+		albedo.reset(w, h);
+		normal.reset(w, h);
+		depth.assign(n, 0.0f);
+		emitter.assign(n, 0.0f);
+		moment1.assign(n, 0.0f);
+		moment2.assign(n, 0.0f);
+		samples = 1;
+	}
+
+	/*	Adds one sample
+	*	@pixel: j * width + i
+	*	@f: what the sample's camera ray saw
+	*	@color: the sample's color
+	*/
+	void add(size_t pixel, const pixel_features& f, const vec3& color) {
+		albedo.add(pixel, f.albedo);
+		normal.add(pixel, f.normal);
+		depth[pixel] += static_cast<float>(f.depth);
+		emitter[pixel] += static_cast<float>(f.emitter);
+		vec3 a = f.albedo;
+		float l = luminance(vec3(color[0] / std::max(a[0], real(1e-3)), color[1] / std::max(a[1], real(1e-3)),
+								 color[2] / std::max(a[2], real(1e-3))));
+		moment1[pixel] += l;
+		moment2[pixel] += l * l;
+	}
+
+	/*	Turns the sums into averages
+	*	@n: the number of samples every pixel got
+	*/
+	void average(int n) {
+		const float s = 1.0f / n;
+		albedo.scale(s);
+		normal.scale(s);
+		for (size_t i = 0; i < depth.size(); i++) {
+			depth[i] *= s;
+			emitter[i] *= s;
+			moment1[i] *= s;
+			moment2[i] *= s;
+		}
+		samples = n;
+	}
+
+	framebuffer albedo;
+	framebuffer normal;
+	std::vector<float> depth;
+	std::vector<float> emitter;	// share of the samples that saw a light
+	std::vector<float> moment1;	// mean luminance of the lighting
+	std::vector<float> moment2;	// mean squared luminance of the lighting
+	int samples;				// per pixel, set by average()
+};
+
+/*	Edge-avoiding À-Trous wavelet filter (Dammertz et al. 2010), with the
+*	color weight scaled by the noise of each pixel as in SVGF (Schied et
+*	al. 2017). The image is divided by the albedo, so texture and material
+*	colors stay sharp and only the lighting is smoothed. Each pass then
+*	blurs it with a 5 x 5 B3-spline kernel whose taps are 2^i pixels apart,
+*	and weights every tap by how close it is to the center pixel in
+*	normal, depth, albedo and share of lights (so a small light is not
+*	smeared over its surroundings), and in luminance relative to the two
+*	pixels' standard deviations: noise is blurred away while real changes
+*	in lighting, such as shadow edges, are kept. The weight is the same
+*	both ways, so a bright pixel gives its dim neighbors as much as it
+*	takes from them and the image keeps its energy. The variance starts as
+*	that of each pixel's mean, from the moments of its samples, and is
+*	filtered along with the color. The albedo is multiplied back in at the end.
+*	Rows are split across threads; a pass only reads the previous one, so
+*	the threads share nothing they write.
+*/
+class denoiser {
+	public:
+		denoiser()
+			: iterations(DENOISE_ITERATIONS), sigma_color(2.0f), sigma_normal(0.2f), sigma_depth(0.02f),
+			  sigma_albedo(0.1f), threads(DENOISE_THREADS), width(0), height(0), used_threads(0),
+			  seconds(0), f(nullptr) {}
+
+		/*	Filters an image
+		*	@color: the noisy image, averaged (linear, not tonemapped)
+		*	@features: the features of the same pixels, averaged
+		*	@out: receives the filtered image, may not be color
+		*/
+		void run(const framebuffer& color, const feature_buffers& features, framebuffer& out) {
+			std::chrono::high_resolution_clock::time_point t = std::chrono::high_resolution_clock::now();
+			width = color.width;
+			height = color.height;
+			f = &features;
+			const size_t n = color.rgb.size();
+
+			// Lighting alone: divide out the albedo.
+			current.resize(n);
+			next.resize(n);
+			for (size_t i = 0; i < n; i++)
+				current[i] = color.rgb[i] / std::max(features.albedo.rgb[i], 1e-3f);
+
+			int pool = threads > 0 ? threads : static_cast<int>(std::thread::hardware_concurrency());
+			pool = std::max(1, std::min(pool, height));
+			variance.resize(color.pixels());
+			variance_next.resize(color.pixels());
+			parallel_rows(pool, -1);
+			variance.swap(variance_next);
+			for (int pass = 0; pass < iterations; pass++) {
+				parallel_rows(pool, pass);
+				current.swap(next);
+				variance.swap(variance_next);
+			}
+
+			out.reset(width, height);
+			for (size_t i = 0; i < n; i++)
+				out.rgb[i] = current[i] * std::max(features.albedo.rgb[i], 1e-3f);
+			used_threads = pool;
+			seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t).count();
+		}
+
+		/*	Prints the time the last run took
+		*	@out: the stream to print to
+		*/
+		void print(std::ostream& out) const {
+			out << "denoised " << width << "x" << height << " in " << iterations << " passes on "
+				<< used_threads << " threads in " << seconds * 1000 << " ms\n";
+		}
+
+		int iterations;
+		// Edge-stopping widths: a tap that differs from the center pixel by
+		// sigma is weighted by e^-1. sigma_color is in standard deviations
+		// of the luminance of the two pixels.
+		float sigma_color;
+		float sigma_normal;
+		float sigma_depth;		// relative to the center pixel's depth
+		float sigma_albedo;		// also used for the share of lights
+		int threads;
+
+	private:
+		static float luminance(const float* c) {
+			return 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+		}
+
+		/*	Runs a pass on pool threads, each on its own band of rows
+		*	@pool: number of threads, this one included
+		*	@pass: the pass, or -1 for the variance estimate
+		*/
+		void parallel_rows(int pool, int pass) {
+			std::vector<std::thread> workers;
+			for (int k = 1; k < pool; k++)
+				workers.push_back(std::thread(&denoiser::filter_rows, this, pass,
+											  height * k / pool, height * (k + 1) / pool));
+			filter_rows(pass, 0, height / pool);
+			for (size_t k = 0; k < workers.size(); k++)
+				workers[k].join();
+		}
+
+		/*	Variance of the mean luminance of every pixel of rows [begin,
+		*	end), from the moments of its samples, into variance_next
+		*/
+		void estimate_rows(int begin, int end) {
+			const float* m1 = &f->moment1[0];
+			const float* m2 = &f->moment2[0];
+			const float inv_samples = 1.0f / std::max(f->samples, 1);
+			for (size_t p = static_cast<size_t>(begin) * width; p < static_cast<size_t>(end) * width; p++)
+				variance_next[p] = std::max(0.0f, m2[p] - m1[p] * m1[p]) * inv_samples;
+		}
+
+		/*	One pass over rows [begin, end): reads current and variance,
+		*	writes next and variance_next
+		*	@pass: which pass, sets the tap spacing; -1 estimates the
+		*	variance instead
+		*	@begin: first row
+		*	@end: one past the last row
+		*/
+		void filter_rows(int pass, int begin, int end) {
+			if (pass < 0) {
+				estimate_rows(begin, end);
+				return;
+			}
+			static const float kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+			const int step = 1 << pass;
+			const float inv_normal = 1.0f / (sigma_normal * sigma_normal);
+			const float inv_albedo = 1.0f / (sigma_albedo * sigma_albedo);
+			const float* normal = &f->normal.rgb[0];
+			const float* albedo = &f->albedo.rgb[0];
+			const float* depth = &f->depth[0];
+			const float* emitter = &f->emitter[0];
+
+			for (int j = begin; j < end; j++) {
+				for (int i = 0; i < width; i++) {
+					const size_t p = static_cast<size_t>(j) * width + i;
+					const float* cp = &current[3 * p];
+					const float* np = &normal[3 * p];
+					const float* ap = &albedo[3 * p];
+					const float zp = depth[p];
+					const float inv_depth = 1.0f / (sigma_depth * step * std::max(zp, 1e-4f));
+					const float lp = luminance(cp);
+					const float vp = variance[p];
+
+					float sum[3] = { 0, 0, 0 };
+					float total = 0, var = 0;
+					for (int dy = -2; dy <= 2; dy++) {
+						int y = j + dy * step;
+						if (y < 0 || y >= height)
+							continue;
+						for (int dx = -2; dx <= 2; dx++) {
+							int x = i + dx * step;
+							if (x < 0 || x >= width)
+								continue;
+							const size_t q = static_cast<size_t>(y) * width + x;
+							const float* cq = &current[3 * q];
+							const float* nq = &normal[3 * q];
+							const float* aq = &albedo[3 * q];
+
+							float dc = std::fabs(luminance(cq) - lp)
+									 / (sigma_color * std::sqrt(0.5f * (vp + variance[q])) + 1e-4f);
+							float e0 = nq[0] - np[0], e1 = nq[1] - np[1], e2 = nq[2] - np[2];
+							float dn = (e0*e0 + e1*e1 + e2*e2) * inv_normal;
+							e0 = aq[0] - ap[0]; e1 = aq[1] - ap[1]; e2 = aq[2] - ap[2];
+							float da = (e0*e0 + e1*e1 + e2*e2) * inv_albedo;
+							float dz = std::fabs(depth[q] - zp) * inv_depth;
+							float de = (emitter[q] - emitter[p]) * (emitter[q] - emitter[p]) * inv_albedo;
+
+							float w = kernel[dx < 0 ? -dx : dx] * kernel[dy < 0 ? -dy : dy]
+									* std::exp(-(dc + dn + da + dz + de));
+							sum[0] += w * cq[0];
+							sum[1] += w * cq[1];
+							sum[2] += w * cq[2];
+							total += w;
+							var += w * w * variance[q];
+						}
+					}
+					// The center tap has weight 3/8 * 3/8, so total > 0.
+					float* o = &next[3 * p];
+					o[0] = sum[0] / total;
+					o[1] = sum[1] / total;
+					o[2] = sum[2] / total;
+					variance_next[p] = var / (total * total);
+				}
+			}
+		}
+
+		int width;
+		int height;
+		int used_threads;
+		double seconds;
+		const feature_buffers* f;
+		std::vector<float> current, next;
+		std::vector<float> variance, variance_next;	// of the luminance of current
+};
+
+#endif
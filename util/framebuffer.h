@@ -0,0 +1,185 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "vec3.h"
+
+/*	High dynamic range image: linear float32 RGB, 3 floats per pixel, with
+*	row 0 at the bottom (PFM order). The renderers accumulate samples into
+*	it; nothing is clamped, gamma-corrected or quantized until tonemap().
+*/
+class framebuffer {
+	public:
+		framebuffer() : width(0), height(0) {}
+		framebuffer(int w, int h) : width(w), height(h), rgb(3 * static_cast<size_t>(w) * h, 0.0f) {}
+
+		/*	Resizes the buffer and sets every pixel to black
+		*/
+		void reset(int w, int h) {
+			width = w;
+			height = h;
+			rgb.assign(3 * static_cast<size_t>(w) * h, 0.0f);
+		}
+
+		size_t pixels() const { return static_cast<size_t>(width) * height; }
+
+		/*	Adds a sample to a pixel
+		*	@pixel: j * width + i
+		*	@c: the linear color of the sample
+		*/
+		void add(size_t pixel, const vec3& c) {
+			float* p = &rgb[3 * pixel];
+			p[0] += static_cast<float>(c[0]);
+			p[1] += static_cast<float>(c[1]);
+			p[2] += static_cast<float>(c[2]);
+		}
+
+		vec3 get(size_t pixel) const {
+			const float* p = &rgb[3 * pixel];
+			return vec3(p[0], p[1], p[2]);
+		}
+
+		/*	Multiplies every value, e.g. by 1 / samples to turn the sums into
+		*	averages
+		*/
+		void scale(float s) {
+			for (size_t i = 0; i < rgb.size(); i++)
+				rgb[i] *= s;
+		}
+
+		bool write_pfm(const char* path) const;
+		bool read_pfm(const char* path, std::string& error);
+
+		int width;
+		int height;
+		std::vector<float> rgb;
+};
+
+/*	Converts linear values to 8-bit display values: scales by exposure,
+*	clamps to [0, 1] and applies 1/gamma. The loops have no branches and no
+*	calls besides sqrtf/powf, so at -O3 (with -ffast-math for powf, which
+*	then comes from the vector math library) they run on SIMD registers.
+*	Gamma 2 takes a sqrt path.
+*	@in: linear values
+*	@out: receives the 8-bit values
+*	@n: number of values (3 per pixel)
+*	@exposure: linear scale factor, 2^stops
+*	@gamma: display gamma
+*/
+inline void tonemap(const float* in, unsigned char* out, size_t n, float exposure, float gamma) {
+	const float inv_gamma = 1.0f / gamma;
+	if (gamma == 2.0f) {
+		for (size_t i = 0; i < n; i++) {
+			float x = in[i] * exposure;
+			x = x > 0.0f ? x : 0.0f;	// also maps NaN to 0
+			x = x < 1.0f ? x : 1.0f;
+			out[i] = static_cast<unsigned char>(255.999f * std::sqrt(x));
+		}
+	} else {
+		for (size_t i = 0; i < n; i++) {
+			float x = in[i] * exposure;
+			x = x > 0.0f ? x : 0.0f;
+			x = x < 1.0f ? x : 1.0f;
+			out[i] = static_cast<unsigned char>(255.999f * std::pow(x, inv_gamma));
+		}
+	}
+}
+
+/*	Tonemaps the image and writes it as a text (P3) or binary (P6) ppm,
+*	top row first
+*	@out: the stream to write to
+*	@fb: the image
+*	@exposure: linear scale factor
+*	@gamma: display gamma
+*	@binary: write P6 instead of P3
+*/
+inline void write_ppm(std::ostream& out, const framebuffer& fb, float exposure, float gamma, bool binary) {
+	std::vector<unsigned char> ldr(fb.rgb.size());
+	if (!ldr.empty())
+		tonemap(&fb.rgb[0], &ldr[0], ldr.size(), exposure, gamma);
+
+	out << (binary ? "P6\n" : "P3\n") << fb.width << " " << fb.height << "\n255\n";
+	const size_t row = 3 * static_cast<size_t>(fb.width);
+	for (int j = fb.height - 1; j >= 0; --j) {
+		const unsigned char* p = &ldr[j * row];
+		if (binary) {
+			out.write(reinterpret_cast<const char*>(p), row);
+			continue;
+		}
+		for (int i = 0; i < fb.width; ++i, p += 3)
+			out << int(p[0]) << ' ' << int(p[1]) << ' ' << int(p[2]) << '\n';
+	}
+}
+
+/*	Writes the image as a PFM file in host byte order
+*	@path: the file to write
+*	returns false if the file could not be written
+*/
+bool framebuffer::write_pfm(const char* path) const {
+	FILE* f = fopen(path, "wb");
+	if (!f)
+		return false;
+	// A negative scale marks little-endian data; the host order is written
+	// and the sign picked to match it.
+	const uint16_t one = 1;
+	unsigned char first;
+	memcpy(&first, &one, 1);
+	fprintf(f, "PF\n%d %d\n%s\n", width, height, first ? "-1.0" : "1.0");
+	bool ok = fwrite(rgb.data(), sizeof(float), rgb.size(), f) == rgb.size();
+	return (fclose(f) == 0) && ok;
+}
+
+/*	Reads a color PFM file (either byte order)
+*	@path: the file to read
+*	@error: receives a message on failure
+*	returns false if the file is not a readable color PFM
+*/
+bool framebuffer::read_pfm(const char* path, std::string& error) {
+	FILE* f = fopen(path, "rb");
+	if (!f) {
+		error = std::string("cannot open ") + path;
+		return false;
+	}
+	char magic[3] = { 0, 0, 0 };
+	int w = 0, h = 0;
+	double order = 0;
+	if (fscanf(f, "%2s %d %d %lf", magic, &w, &h, &order) != 4 || strcmp(magic, "PF") != 0
+			|| w <= 0 || h <= 0 || order == 0) {
+		error = "not a color pfm file";
+		fclose(f);
+		return false;
+	}
+	fgetc(f);	// the single whitespace byte before the data
+	reset(w, h);
+	size_t got = fread(rgb.data(), sizeof(float), rgb.size(), f);
+	fclose(f);
+	if (got != rgb.size()) {
+		error = "pfm data is truncated";
+		return false;
+	}
+
+	const uint16_t one = 1;
+	unsigned char first;
+	memcpy(&first, &one, 1);
+	const bool file_little = order < 0;
+	if (file_little != (first == 1)) {
+		for (size_t i = 0; i < rgb.size(); i++) {
+			unsigned char b[4];
+			memcpy(b, &rgb[i], 4);
+			std::swap(b[0], b[3]);
+			std::swap(b[1], b[2]);
+			memcpy(&rgb[i], b, 4);
+		}
+	}
+	return true;
+}
+
+#endif
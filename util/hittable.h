@@ -3,23 +3,32 @@
 
 #include "ray.h"
 #include "aabb.h"
+#include "packet.h"
 #include "util.h"
 
-class material;
+class hittable;
 
+// The hit record is written on every closer hit found during traversal, so
+// it only holds plain values: no shared_ptr (whose copies cost atomic
+// refcount updates) and no per-primitive Phong colors, which are read from
+// the primitive itself when they are needed.
+//
+// Intersection is two-phase. hit() only fills in the fields up to mat_id;
+// the surface attributes below are expanded once, for the closest hit, by
+// calling rec.obj->get_surface(r, rec).
 struct hit_record {
+    real t;
+	const hittable* obj;		// the primitive that was hit
+	int prim_id;				// which part of obj was hit (e.g. a face index)
+	real b1, b2;				// barycentric coordinates of triangle hits
+	int mat_id;					// index into the scene's material_table
+
+	// surface attributes, valid after get_surface()
     vec3 p;
     vec3 n;
-    double t;
-	vec3 kd;
-	vec3 ks;
-	int v1i;
-	int v2i;
-	int v3i;
-	shared_ptr<material> mat_ptr;
 	bool front_face;
-	double u;
-	double v;
+	real u;
+	real v;
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
@@ -27,10 +36,70 @@ struct hit_record {
     }
 };
 
+// Closest hits for every lane of a ray_packet. t_max[i] shrinks as closer
+// hits are found; bit i of hit is set once lane i has hit something.
+struct packet_hits {
+	hit_record rec[PACKET_SIZE];
+	real t_max[PACKET_SIZE];
+	lane_mask hit;
+};
+
 class hittable {
     public:
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const = 0;
 		virtual bool bounding_box(double time0, double time1, aabb& output_box) const = 0;
+
+		/*	Expands the surface attributes (p, n, front_face, u, v) of a hit
+		*	this primitive reported. Called once for the closest hit only.
+		*	@r: the ray that produced the hit
+		*	@rec: hit record filled in by hit(), completed in place
+		*/
+		virtual void get_surface(const ray& r, hit_record& rec) const {}
+
+		/*	Diffuse and specular colors used by Phong shading.
+		*/
+		virtual vec3 phong_kd() const { return vec3(0,0,0); }
+		virtual vec3 phong_ks() const { return vec3(0,0,0); }
+
+		/*	Light sampling, for primitives that can be lights: picks a
+		*	direction from o towards a point on the primitive.
+		*	@o: the point being lit
+		*	@u1, @u2: uniform numbers in [0,1) that choose the point
+		*	@pdf: receives the density of the direction per solid angle,
+		*	0 if nothing could be sampled
+		*	returns the direction, from o to the point (not normalized)
+		*/
+		virtual vec3 sample(const vec3& o, real u1, real u2, real& pdf) const {
+			pdf = 0;
+			return vec3(0,0,1);
+		}
+
+		/*	Density per solid angle with which sample() picks the direction
+		*	dir from o, 0 if dir misses the primitive.
+		*/
+		virtual real pdf(const vec3& o, const vec3& dir) const { return 0; }
+
+		/*	Surface area, used to estimate the power of a light.
+		*/
+		virtual real area() const { return 0; }
+
+		/*	Intersects the active lanes of a ray packet. The default traces each
+		*	lane on its own; BVH nodes, lists and spheres override it to share
+		*	the work across the packet.
+		*	@p: the ray packet
+		*	@t_min: min value of t
+		*	@hits: per-lane closest hits, updated in place
+		*	@active: the lanes to test
+		*/
+		virtual void hit_packet(const ray_packet& p, real t_min, packet_hits& hits, lane_mask active) const {
+			for (int i = 0; i < PACKET_SIZE; i++) {
+				if (!(active >> i & 1)) continue;
+				if (hit(p.get(i), t_min, hits.t_max[i], hits.rec[i])) {
+					hits.t_max[i] = hits.rec[i].t;
+					hits.hit |= lane_mask(1) << i;
+				}
+			}
+		}
 };
 
 #endif
@@ -2,27 +2,40 @@
 #include "aabb.h"
 
 /* Determines if the ray hits any objects in the list
+*	Objects only write rec when they find a hit closer than closest_so_far,
+*	so rec can be passed straight down instead of copying a temporary record
+*	on every closer hit.
 *	@r: ray to cast
 *	@t_min: min value of t
 *	@t_max: max value of t
 *	@rec: hit record to store the info
 */
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    hit_record temp_rec;
+bool hittable_list::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     bool hit_anything = false;
     auto closest_so_far = t_max;
 
     for (const auto& object : objects) {
-        if (object->hit(r, t_min, closest_so_far, temp_rec)) {
+        if (object->hit(r, t_min, closest_so_far, rec)) {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = rec.t;
         }
     }
 
     return hit_anything;
 }
 
+/* Intersects a ray packet with every object in the list
+*	@p: ray packet to cast
+*	@t_min: min value of t
+*	@hits: per-lane hit records, updated with closer hits
+*	@active: the lanes to test
+*/
+void hittable_list::hit_packet(const ray_packet& p, real t_min, packet_hits& hits, lane_mask active) const {
+	for (const auto& object : objects) {
+		object->hit_packet(p, t_min, hits, active);
+	}
+}
+
 /*	Constructs a bounding box for a hittable_list.
 *	@time0: t0 time interval for moving objects
 *	@time1: t1 time interval for moving objects
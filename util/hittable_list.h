@@ -29,7 +29,9 @@ class hittable_list : public hittable {
         void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
         virtual bool hit(
-            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+            const ray& r, real t_min, real t_max, hit_record& rec) const override;
+		virtual void hit_packet(
+			const ray_packet& p, real t_min, packet_hits& hits, lane_mask active) const override;
 		virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
 
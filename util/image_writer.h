@@ -0,0 +1,191 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "framebuffer.h"
+
+// Rows that can be waiting for the writer thread before the renderer has
+// to wait for it.
+#ifndef IMAGE_WRITER_ROWS
+#define IMAGE_WRITER_ROWS 64
+#endif
+
+/*	Writes the image on its own thread while rendering continues. The
+*	renderer hands over finished rows of linear (averaged) color through a
+*	lock-free single-producer/single-consumer ring; the writer thread
+*	tonemaps and encodes each row, streams the ppm in scanline order and
+*	puts the float row at its place in the pfm with pwrite. Neither side
+*	ever holds the whole image: memory is IMAGE_WRITER_ROWS rows.
+*	Rows must be pushed top row (height - 1) first, the order of the ppm.
+*/
+class image_writer {
+	public:
+		/*	Starts the writer thread and writes the file headers
+		*	@ppm: stream for the tonemapped image
+		*	@pfm_path: file for the linear float image, or null for none
+		*	@w: image width
+		*	@h: image height
+		*	@exposureu: linear scale factor for the ppm
+		*	@gammau: display gamma for the ppm
+		*	@binaryu: write the ppm as P6 instead of P3
+		*/
+		image_writer(std::ostream& ppm, const char* pfm_path, int w, int h,
+					 float exposureu, float gammau, bool binaryu)
+			: out(ppm), width(w), height(h), exposure(exposureu), gamma(gammau), binary(binaryu),
+			  pfm(-1), pfm_header(0), ring(IMAGE_WRITER_ROWS * 3 * static_cast<size_t>(w)),
+			  rows(IMAGE_WRITER_ROWS), head(0), tail(0), done(false), failed(false),
+			  stall_time(0), encode_time(0), write_time(0) {
+			out << (binary ? "P6\n" : "P3\n") << width << " " << height << "\n255\n";
+			if (pfm_path) {
+				pfm = open(pfm_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+				if (pfm < 0) {
+					perror(pfm_path);
+				} else {
+					// Written in host byte order; the sign of the scale says which.
+					const uint16_t one = 1;
+					unsigned char first;
+					memcpy(&first, &one, 1);
+					char header[64];
+					pfm_header = snprintf(header, sizeof(header), "PF\n%d %d\n%s\n", width, height,
+										  first ? "-1.0" : "1.0");
+					failed = write(pfm, header, pfm_header) != static_cast<ssize_t>(pfm_header);
+				}
+			}
+			worker = std::thread(&image_writer::run, this);
+		}
+
+		~image_writer() { finish(); }
+
+		/*	Queues a finished row, waiting only if the ring is full. The
+		*	values are copied, so the caller can reuse its buffer.
+		*	@j: the row, counting from the bottom like framebuffer
+		*	@rgb: 3 * width linear floats
+		*/
+		void push_row(int j, const float* rgb) {
+			size_t h = head.load(std::memory_order_relaxed);
+			if (h - tail.load(std::memory_order_acquire) == IMAGE_WRITER_ROWS) {
+				std::chrono::high_resolution_clock::time_point t = std::chrono::high_resolution_clock::now();
+				while (h - tail.load(std::memory_order_acquire) == IMAGE_WRITER_ROWS)
+					std::this_thread::yield();
+				stall_time += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t).count();
+			}
+			size_t slot = h % IMAGE_WRITER_ROWS;
+			memcpy(&ring[slot * 3 * width], rgb, 3 * sizeof(float) * width);
+			rows[slot] = j;
+			head.store(h + 1, std::memory_order_release);
+		}
+
+		/*	Waits until every queued row is written and closes the pfm.
+		*	returns false if a write failed
+		*/
+		bool finish() {
+			if (worker.joinable()) {
+				done.store(true, std::memory_order_release);
+				worker.join();
+				out.flush();
+				if (pfm >= 0)
+					failed = (close(pfm) != 0) || failed;
+				pfm = -1;
+			}
+			return !failed && out.good();
+		}
+
+		/*	Prints where the time went: stall is what the renderer waited
+		*	for a free slot, encode and write are spent on the writer thread.
+		*/
+		void print(std::ostream& os) const {
+			os << "image writer: renderer stalled " << stall_time * 1000 << " ms, encode " << encode_time * 1000
+			   << " ms, write " << write_time * 1000 << " ms (on the writer thread)" << std::endl;
+		}
+
+	private:
+		image_writer(const image_writer&);
+		image_writer& operator=(const image_writer&);
+
+		/*	Writer thread: drains the ring until finish() is called and the
+		*	ring is empty.
+		*/
+		void run() {
+			typedef std::chrono::high_resolution_clock clock;
+			const size_t n = 3 * static_cast<size_t>(width);
+			std::vector<unsigned char> ldr(n);
+			std::string text;
+			int idle = 0;
+			for (;;) {
+				size_t t = tail.load(std::memory_order_relaxed);
+				if (t == head.load(std::memory_order_acquire)) {
+					if (done.load(std::memory_order_acquire) && t == head.load(std::memory_order_acquire))
+						return;
+					// Spin briefly, then give the core back to the renderer.
+					if (++idle < 64)
+						std::this_thread::yield();
+					else
+						std::this_thread::sleep_for(std::chrono::microseconds(200));
+					continue;
+				}
+				idle = 0;
+				size_t slot = t % IMAGE_WRITER_ROWS;
+				const float* rgb = &ring[slot * n];
+				const int j = rows[slot];
+
+				clock::time_point t0 = clock::now();
+				tonemap(rgb, &ldr[0], n, exposure, gamma);
+				if (!binary) {
+					text.clear();
+					char buf[16];
+					for (size_t i = 0; i < n; i += 3) {
+						int len = snprintf(buf, sizeof(buf), "%d %d %d\n", ldr[i], ldr[i+1], ldr[i+2]);
+						text.append(buf, len);
+					}
+				}
+				clock::time_point t1 = clock::now();
+				if (binary)
+					out.write(reinterpret_cast<const char*>(&ldr[0]), n);
+				else
+					out.write(text.data(), text.size());
+				if (pfm >= 0) {
+					off_t at = static_cast<off_t>(pfm_header) + static_cast<off_t>(j) * n * sizeof(float);
+					if (pwrite(pfm, rgb, n * sizeof(float), at) != static_cast<ssize_t>(n * sizeof(float)))
+						failed = true;
+				}
+				clock::time_point t2 = clock::now();
+				encode_time += std::chrono::duration<double>(t1 - t0).count();
+				write_time += std::chrono::duration<double>(t2 - t1).count();
+
+				tail.store(t + 1, std::memory_order_release);
+			}
+		}
+
+		std::ostream& out;
+		const int width;
+		const int height;
+		const float exposure;
+		const float gamma;
+		const bool binary;
+		int pfm;					// file descriptor, -1 if none
+		size_t pfm_header;			// bytes before the first row
+
+		std::vector<float> ring;	// IMAGE_WRITER_ROWS rows of 3 * width floats
+		std::vector<int> rows;		// row number held by each slot
+		std::atomic<size_t> head;	// rows pushed, written by the renderer only
+		std::atomic<size_t> tail;	// rows written, written by the writer only
+		std::atomic<bool> done;
+		bool failed;
+		std::thread worker;
+
+		double stall_time;			// renderer thread
+		double encode_time;			// writer thread
+		double write_time;			// writer thread
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef LIGHT_LIST_H
+#define LIGHT_LIST_H
+
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include "util.h"
+#include "hittable.h"
+#include "material.h"
+
+/*	Multiple importance sampling weight of a sample drawn with density f
+*	when another strategy could have drawn it with density g (Veach's power
+*	heuristic with exponent 2).
+*/
+inline real power_heuristic(real f, real g) {
+	return f*f / (f*f + g*g);
+}
+
+/*	The emitters of a scene, for next-event estimation: at every diffuse
+*	hit one of them is picked, a point on it sampled and a shadow ray cast
+*	towards it. The lights are added to the world as usual and also here;
+*	a light must be a primitive (a sphere or rect, not a list or BVH) so
+*	the pointer a shadow ray hits can be compared with it.
+*	A light is picked in proportion to its power (emitted radiance times
+*	area) from an alias table, so one uniform number picks it in O(1)
+*	however many lights there are. Call build() after the last add().
+*/
+class light_list {
+	public:
+		light_list() : build_seconds(0) {}
+
+		/*	Adds an emitter
+		*	@light: a primitive that implements sample(), pdf() and area()
+		*	@m: its diffuse_light material, for the power estimate
+		*/
+		void add(shared_ptr<hittable> light, const material& m) {
+			index[light.get()] = static_cast<int>(lights.size());
+			lights.push_back(light);
+			vec3 c = m.color(0.5, 0.5, vec3(0,0,0));
+			real luminance = 0.2126 * c[0] + 0.7152 * c[1] + 0.0722 * c[2];
+			power.push_back(std::max(real(0), luminance) * light->area() * pi);
+		}
+
+		/*	Builds the alias table (Vose's method) from the light powers. If
+		*	no light reports a power, every light gets the same chance.
+		*/
+		void build() {
+			std::chrono::high_resolution_clock::time_point t = std::chrono::high_resolution_clock::now();
+			const size_t n = lights.size();
+			real total = 0;
+			for (size_t k = 0; k < n; k++)
+				total += power[k];
+			chance.resize(n);
+			for (size_t k = 0; k < n; k++)
+				chance[k] = total > 0 ? power[k] / total : real(1) / n;
+
+			// Scale to mean 1 and pair every below-average entry with an
+			// above-average one that fills the rest of its slot.
+			prob.resize(n);
+			alias.resize(n);
+			std::vector<int> small, large;
+			std::vector<real> scaled(n);
+			for (size_t k = 0; k < n; k++) {
+				scaled[k] = chance[k] * n;
+				(scaled[k] < 1 ? small : large).push_back(static_cast<int>(k));
+			}
+			while (!small.empty() && !large.empty()) {
+				int s = small.back(), l = large.back();
+				small.pop_back();
+				prob[s] = scaled[s];
+				alias[s] = l;
+				scaled[l] -= 1 - scaled[s];
+				if (scaled[l] < 1) {
+					large.pop_back();
+					small.push_back(l);
+				}
+			}
+			// What is left is 1 up to rounding.
+			for (size_t k = 0; k < large.size(); k++) {
+				prob[large[k]] = 1;
+				alias[large[k]] = large[k];
+			}
+			for (size_t k = 0; k < small.size(); k++) {
+				prob[small[k]] = 1;
+				alias[small[k]] = small[k];
+			}
+			build_seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t).count();
+		}
+
+		bool empty() const { return lights.empty(); }
+		size_t size() const { return lights.size(); }
+
+		/*	Picks a light and a direction towards it
+		*	@p: the point being lit
+		*	@u0: uniform number that picks the light
+		*	@u1, @u2: uniform numbers that pick the point on it
+		*	@dir: receives the direction, from p to the light
+		*	@pdf: receives the density of dir per solid angle, with the
+		*	probability of picking the light included
+		*	returns the light, or null if there is nothing to sample
+		*/
+		const hittable* sample(const vec3& p, real u0, real u1, real u2, vec3& dir, real& pdf) const {
+			if (prob.empty())
+				return nullptr;
+			// The integer part of u0 * n picks the slot, the fraction picks
+			// between the slot's light and its alias.
+			const size_t n = prob.size();
+			real x = u0 * n;
+			size_t k = std::min(static_cast<size_t>(x), n - 1);
+			if (x - k >= prob[k])
+				k = alias[k];
+			dir = lights[k]->sample(p, u1, u2, pdf);
+			if (!(pdf > 0))
+				return nullptr;
+			pdf *= chance[k];
+			return lights[k].get();
+		}
+
+		/*	Density with which sample() would have picked the direction dir
+		*	from o towards obj, 0 if obj is not one of the lights
+		*	@obj: the primitive dir hits
+		*	@o: the point being lit
+		*	@dir: the direction
+		*/
+		real pdf(const hittable* obj, const vec3& o, const vec3& dir) const {
+			std::unordered_map<const hittable*, int>::const_iterator it = index.find(obj);
+			if (it == index.end() || chance.empty())
+				return 0;
+			return obj->pdf(o, dir) * chance[it->second];
+		}
+
+		/*	Prints the size and build time of the selection table
+		*	@out: the stream to print to
+		*/
+		void print(std::ostream& out) const {
+			size_t bytes = prob.size() * (sizeof(real) * 2 + sizeof(int));
+			out << "lights: " << lights.size() << ", alias table " << bytes / 1e3 << " kB built in "
+				<< build_seconds * 1000 << " ms\n";
+		}
+
+	private:
+		std::vector<shared_ptr<hittable> > lights;
+		std::unordered_map<const hittable*, int> index;
+		std::vector<real> power;	// estimated emitted power of each light
+		std::vector<real> chance;	// probability of picking each light
+		std::vector<real> prob;		// alias table: keep slot k with prob[k]...
+		std::vector<int> alias;		// ...else take alias[k]
+		double build_seconds;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*	Read-only memory mapping of a whole file. Mesh loaders parse straight
+*	out of the mapping instead of copying the file through stdio buffers.
+*/
+class mapped_file {
+	public:
+		/*	Maps the file. Check ok() afterwards; errno is set on failure.
+		*	@path: path of the file
+		*	@whole: the whole file will be read, so start reading it ahead;
+		*	pass false for files that are only read here and there
+		*/
+		explicit mapped_file(const char* path, bool whole = true) : ptr(NULL), len(0), fd(-1), mapped(false) {
+			fd = open(path, O_RDONLY);
+			if (fd < 0)
+				return;
+			struct stat st;
+			if (fstat(fd, &st) != 0)
+				return;
+			len = static_cast<size_t>(st.st_size);
+			if (len == 0) {
+				mapped = true;
+				return;
+			}
+			void* p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED)
+				return;
+			madvise(p, len, whole ? MADV_WILLNEED : MADV_RANDOM);
+			ptr = static_cast<const char*>(p);
+			mapped = true;
+		}
+
+		~mapped_file() {
+			if (ptr)
+				munmap(const_cast<char*>(ptr), len);
+			if (fd >= 0)
+				close(fd);
+		}
+
+		bool ok() const { return mapped; }
+		const char* data() const { return ptr; }
+		const char* end() const { return ptr + len; }
+		size_t size() const { return len; }
+
+	private:
+		mapped_file(const mapped_file&);
+		mapped_file& operator=(const mapped_file&);
+
+		const char* ptr;
+		size_t len;
+		int fd;
+		bool mapped;
+};
+
+#endif
@@ -1,170 +1,199 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include <vector>
+
 #include "util.h"
+#include "hittable.h"
 #include "texture.h"
-
-struct hit_record;
-
-class material {
-    public:
-		/*	Returns an emitted color at point p
-		*	@u: u texture coordinate
-		*	@v: v texture coordinate
-		*	@p: vec3 point
-		*	returns a color at that point
-		*/ 
-		virtual vec3 emitted(double u, double v, const vec3& p) const {
-            return vec3(0,0,0);
-        }
-
-		/* scatters light ray according to material
-		*	@r_in: ray to scatter
-		*	@rec: hit record struct
-		*	@attenuation: how much the light should be attenuated by
-		*	@scattered: the scattered ray
-		*	returns true if scattering occurs
-		*/
-        virtual bool scatter(
-            const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered
-        ) const = 0;
+#include "onb.h"
+
+// Materials are plain data: a type tag plus the parameters of every type
+// kept inline. They live in a flat material_table and primitives refer to
+// them by index, so shading is a switch on the tag instead of a virtual
+// call through a pointer per bounce.
+enum material_type {
+	LAMBERTIAN,
+	METAL,
+	DIELECTRIC,
+	DIFFUSE_LIGHT
 };
 
-class lambertian : public material {
-    public:
-        lambertian(const vec3& a) : albedo(make_shared<solid_color>(a)) {}
-        lambertian(shared_ptr<texture> a) : albedo(a) {}
-
-		/* scatters light ray according to material
-		*	@r_in: ray to scatter
-		*	@rec: hit record struct
-		*	@attenuation: how much the light should be attenuated by
-		*	@scattered: the scattered ray
-		*	returns true if scattering occurs
-		*/
-        virtual bool scatter(
-            const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered
-        ) const override {
-            auto scatter_direction = rec.n + random_unit_vector();
-
-            // Catch degenerate scatter direction
-            if (scatter_direction.near_zero())
-                scatter_direction = rec.n;
-
-            scattered = ray(rec.p, scatter_direction);
-            attenuation = albedo->value(rec.u, rec.v, rec.p);
-            return true;
-        }
-
-    public:
-        shared_ptr<texture> albedo;
+struct material {
+	material_type type;
+	vec3 albedo;				// lambertian/metal albedo, diffuse_light emission
+	double ir;					// dielectric index of refraction
+	shared_ptr<texture> tex;	// if set, replaces albedo (lambertian, diffuse_light)
+
+	/*	Returns the albedo (or emission) at a hit point
+	*	@u: u texture coordinate
+	*	@v: v texture coordinate
+	*	@p: vec3 point
+	*/
+	vec3 color(double u, double v, const vec3& p) const {
+		return tex ? tex->value(u, v, p) : albedo;
+	}
 };
 
-class metal : public material {
-    public:
-        metal(const vec3& a) : albedo(a) {}
-
-		/* scatters light ray according to material
-		*	@r_in: ray to scatter
-		*	@rec: hit record struct
-		*	@attenuation: how much the light should be attenuated by
-		*	@scattered: the scattered ray
-		*	returns true if scattering occurs
+/*	Material constructors
+*/
+inline material lambertian(const vec3& a) {
+	material m;
+	m.type = LAMBERTIAN;
+	m.albedo = a;
+	m.ir = 1;
+	return m;
+}
+
+inline material lambertian(shared_ptr<texture> a) {
+	material m = lambertian(vec3(0,0,0));
+	m.tex = a;
+	return m;
+}
+
+inline material metal(const vec3& a) {
+	material m = lambertian(a);
+	m.type = METAL;
+	return m;
+}
+
+inline material dielectric(double index_of_refraction) {
+	material m = lambertian(vec3(1.0, 1.0, 1.0));
+	m.type = DIELECTRIC;
+	m.ir = index_of_refraction;
+	return m;
+}
+
+inline material diffuse_light(const vec3& c) {
+	material m = lambertian(c);
+	m.type = DIFFUSE_LIGHT;
+	return m;
+}
+
+inline material diffuse_light(shared_ptr<texture> a) {
+	material m = lambertian(a);
+	m.type = DIFFUSE_LIGHT;
+	return m;
+}
+
+/*	Flat table of every material in a scene, indexed by material ID.
+*/
+class material_table {
+	public:
+		/*	Adds a material to the table
+		*	@m: the material
+		*	returns the material ID to give to primitives
 		*/
-        virtual bool scatter(
-            const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered
-        ) const override {
-            vec3 reflected = reflect(normalize(r_in.direction()), rec.n);
-			double eps = 1e-5;
-            scattered = ray(rec.p + vec3(eps,eps,eps)*normalize(reflected), normalize(reflected));
-            attenuation = albedo;
-            return (dot(scattered.direction(), rec.n) > 0);
-        }
-
-    public:
-        vec3 albedo;
-};
+		int add(const material& m) {
+			materials.push_back(m);
+			return static_cast<int>(materials.size()) - 1;
+		}
 
-class dielectric : public material {
-    public:
-        dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+		const material& operator[](int id) const { return materials[id]; }
+		int size() const { return static_cast<int>(materials.size()); }
 
-		/* scatters light ray according to material
-		*	@r_in: ray to scatter
-		*	@rec: hit record struct
-		*	@attenuation: how much the light should be attenuated by
-		*	@scattered: the scattered ray
-		*	returns true if scattering occurs
-		*/
-        virtual bool scatter(
-            const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered
-        ) const override {
-            attenuation = vec3(1.0, 1.0, 1.0);
-            double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
-
-            vec3 unit_direction = normalize(r_in.direction());
-            double cos_theta = fmin(dot(-unit_direction, rec.n), 1.0);
-            double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
-
-            bool cannot_refract = refraction_ratio * sin_theta > 1.0;
-            vec3 direction;
-
-            if (cannot_refract || reflectance(cos_theta, refraction_ratio))
-                direction = reflect(unit_direction, rec.n);
-            else
-                direction = refract(unit_direction, rec.n, refraction_ratio);
-
-            scattered = ray(rec.p, direction);
-            return true;
-        }
-
-    public:
-        double ir; // Index of Refraction
-
-    private:
-		/*	Uses Schlick's approximation to determine if we should reflect
-		*	@cosine: cos value of ray to normal
-		*	@ref_idx: refraction ratio
-		*	returns a boolean to determine if we should reflect
-		*/
-        static bool reflectance(double cosine, double ref_idx) {
-            // Use Schlick's approximation for reflectance.
-            auto r0 = (1-ref_idx) / (1+ref_idx);
-            r0 = r0*r0;
-            return r0 + (1-r0)*pow((1 - cosine),5) > random_double();
-        }
+	public:
+		std::vector<material> materials;
 };
 
-class diffuse_light : public material  {
-    public:
-        diffuse_light(shared_ptr<texture> a) : emit(a) {}
-        diffuse_light(vec3 c) : emit(make_shared<solid_color>(c)) {}
-
-		/* scatters light ray according to material
-		*	@r_in: ray to scatter
-		*	@rec: hit record struct
-		*	@attenuation: how much the light should be attenuated by
-		*	@scattered: the scattered ray
-		*	returns true if scattering occurs
-		*/
-        virtual bool scatter(
-            const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered
-        ) const override {
-            return false;
-        }
-
-		/*	Returns an emitted color at point p
-		*	@u: u texture coordinate
-		*	@v: v texture coordinate
-		*	@p: vec3 point
-		*	returns a color at that point
-		*/ 
-        virtual vec3 emitted(double u, double v, const vec3& p) const override {
-            return emit->value(u, v, p);
-        }
-
-    public:
-        shared_ptr<texture> emit;
-};
+/*	Uses Schlick's approximation to determine if we should reflect
+*	@cosine: cos value of ray to normal
+*	@ref_idx: refraction ratio
+*	@u: uniform number that makes the choice
+*	returns a boolean to determine if we should reflect
+*/
+inline bool reflectance(double cosine, double ref_idx, real u) {
+	// Use Schlick's approximation for reflectance.
+	auto r0 = (1-ref_idx) / (1+ref_idx);
+	r0 = r0*r0;
+	return r0 + (1-r0)*pow((1 - cosine),5) > u;
+}
+
+/*	Returns an emitted color at point p
+*	@m: the material that was hit
+*	@u: u texture coordinate
+*	@v: v texture coordinate
+*	@p: vec3 point
+*	returns a color at that point
+*/
+inline vec3 emitted(const material& m, double u, double v, const vec3& p) {
+	if (m.type == DIFFUSE_LIGHT)
+		return m.color(u, v, p);
+	return vec3(0,0,0);
+}
+
+/*	Density per solid angle with which scatter() picks the direction of
+*	scattered, for weighting it against light sampling. 0 for the specular
+*	materials, whose single direction no light sample can reproduce.
+*	@m: the material that was hit
+*	@rec: hit record struct
+*	@scattered: the scattered ray
+*/
+inline real scatter_pdf(const material& m, const hit_record& rec, const ray& scattered) {
+	if (m.type != LAMBERTIAN)
+		return 0;
+	return cosine_hemisphere_pdf(dot(rec.n, normalize(scattered.direction())));
+}
+
+/* scatters light ray according to material
+*	@m: the material that was hit
+*	@r_in: ray to scatter
+*	@rec: hit record struct
+*	@attenuation: how much the light should be attenuated by
+*	@scattered: the scattered ray
+*	@u1, @u2: uniform numbers that pick a diffuse direction
+*	@u3: uniform number that picks reflection or refraction
+*	returns true if scattering occurs
+*/
+inline bool scatter(const material& m, const ray& r_in, const hit_record& rec,
+					vec3& attenuation, ray& scattered, real u1, real u2, real u3) {
+	switch (m.type) {
+		case LAMBERTIAN: {
+			// Cosine-weighted around the normal, the density scatter_pdf reports
+			vec3 scatter_direction = onb(rec.n).local(sample_cosine_hemisphere(u1, u2));
+			scattered = ray(offset_ray_origin(rec.p, rec.n, scatter_direction), scatter_direction);
+			attenuation = m.color(rec.u, rec.v, rec.p);
+			return true;
+		}
+
+		case METAL: {
+			vec3 reflected = normalize(reflect(normalize(r_in.direction()), rec.n));
+			scattered = ray(offset_ray_origin(rec.p, rec.n, reflected), reflected);
+			attenuation = m.albedo;
+			return (dot(scattered.direction(), rec.n) > 0);
+		}
+
+		case DIELECTRIC: {
+			attenuation = m.albedo;
+			double refraction_ratio = rec.front_face ? (1.0/m.ir) : m.ir;
+
+			vec3 unit_direction = normalize(r_in.direction());
+			double cos_theta = fmin(dot(-unit_direction, rec.n), 1.0);
+			double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
+
+			bool cannot_refract = refraction_ratio * sin_theta > 1.0;
+			vec3 direction;
+
+			if (cannot_refract || reflectance(cos_theta, refraction_ratio, u3))
+				direction = reflect(unit_direction, rec.n);
+			else
+				direction = refract(unit_direction, rec.n, refraction_ratio);
+
+			scattered = ray(offset_ray_origin(rec.p, rec.n, direction), direction);
+			return true;
+		}
+
+		case DIFFUSE_LIGHT:
+		default:
+			return false;
+	}
+}
+
+/*	scatter() with its random numbers drawn from random_double()
+*/
+inline bool scatter(const material& m, const ray& r_in, const hit_record& rec,
+					vec3& attenuation, ray& scattered) {
+	return scatter(m, r_in, rec, attenuation, scattered, random_double(), random_double(), random_double());
+}
 
 #endif
@@ -0,0 +1,327 @@
+#ifndef OBJ_PARSE_H
+#define OBJ_PARSE_H
+
+#include <climits>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "vec3.h"
+
+/*	Skips spaces, tabs and carriage returns
+*/
+inline const char* skip_blanks(const char* p, const char* end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+	return p;
+}
+
+inline bool is_blank(char c) {
+	return c == ' ' || c == '\t';
+}
+
+/*	Parses a decimal integer at p and moves p past it
+*/
+inline int parse_int(const char*& p, const char* end) {
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+	int x = 0;
+	while (p < end && *p >= '0' && *p <= '9')
+		x = x * 10 + (*p++ - '0');
+	return neg ? -x : x;
+}
+
+/*	Parses a decimal floating point number (with optional exponent) at p
+*	and moves p past it. Digits past the 19th only shift the exponent, so
+*	the result can differ from strtod in the last bit.
+*/
+inline real parse_real(const char*& p, const char* end) {
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); digits += (mantissa != 0); }
+		else exponent++;
+		p++;
+	}
+	if (p < end && *p == '.') {
+		p++;
+		while (p < end && *p >= '0' && *p <= '9') {
+			if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); digits += (mantissa != 0); exponent--; }
+			p++;
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		exponent += parse_int(p, end);
+	}
+
+	double x = static_cast<double>(mantissa);
+	if (exponent < 0)
+		x = (exponent >= -22) ? x / pow10[-exponent] : x * std::pow(10.0, exponent);
+	else if (exponent > 0)
+		x = (exponent <= 22) ? x * pow10[exponent] : x * std::pow(10.0, exponent);
+	return static_cast<real>(neg ? -x : x);
+}
+
+/*	Indexed triangle mesh as read from an obj file. Every triangle has three
+*	corners; each corner has a position index and, when the file gives
+*	them, a texture coordinate and a normal index (-1 otherwise). All
+*	indices are 0-based.
+*/
+struct obj_mesh {
+	std::vector<vec3> positions;
+	std::vector<real> texcoords;			// u, v per "vt" line
+	std::vector<vec3> normals;				// one per "vn" line
+	std::vector<int> indices;				// position index, 3 per triangle
+	std::vector<int> uv_indices;			// texcoord index per corner or -1
+	std::vector<int> normal_indices;		// normal index per corner or -1
+	std::vector<int> face_materials;		// per triangle, into material_names, -1 if none
+	std::vector<std::string> material_names;	// "usemtl" names in order of first use
+};
+
+// Marks an index that cannot be valid: 0, or a negative one that reaches
+// back past the first element. Unlike -1 ("absent") it fails the check in
+// check_obj_indices.
+const int OBJ_BAD_INDEX = INT_MIN;
+
+/*	What one parser thread reads from its chunk of the file. Indices are
+*	kept as in obj_mesh except for negative (relative) ones: those are
+*	stored relative to the first element of this chunk and listed in the
+*	rel_* arrays so the merge can add the chunk's offset. Material IDs are
+*	local to material_names, and -1 marks triangles before the first
+*	usemtl of the chunk, which inherit the material of the chunk before.
+*/
+struct obj_chunk {
+	obj_mesh mesh;
+	std::vector<size_t> rel_p, rel_t, rel_n;
+	int last_material = -1;		// material active at the end of the chunk
+};
+
+/*	Reads one corner "p", "p/t", "p//n" or "p/t/n" of a face
+*	@p: cursor, moved past the corner
+*	@end: end of the chunk
+*	@out: the chunk, for the current element counts
+*	@cp, @ct, @cn: receive the indices, -1 if absent
+*	@rp, @rt, @rn: set if the index was negative (relative to the chunk)
+*/
+inline void parse_obj_corner(const char*& p, const char* end, const obj_chunk& out,
+							 int& cp, int& ct, int& cn, bool& rp, bool& rt, bool& rn) {
+	ct = cn = -1;
+	rp = rt = rn = false;
+
+	int k = parse_int(p, end);
+	rp = k < 0;
+	cp = rp ? static_cast<int>(out.mesh.positions.size()) + k : (k ? k - 1 : OBJ_BAD_INDEX);
+	if (p < end && *p == '/') {
+		p++;
+		if (p < end && *p != '/') {
+			k = parse_int(p, end);
+			rt = k < 0;
+			ct = rt ? static_cast<int>(out.mesh.texcoords.size() / 2) + k : (k ? k - 1 : OBJ_BAD_INDEX);
+		}
+		if (p < end && *p == '/') {
+			p++;
+			k = parse_int(p, end);
+			rn = k < 0;
+			cn = rn ? static_cast<int>(out.mesh.normals.size()) + k : (k ? k - 1 : OBJ_BAD_INDEX);
+		}
+	}
+}
+
+/*	Parses the lines in [p, end) of an obj file in a single pass. Reads
+*	v, vt, vn, f (any number of corners, fan-triangulated) and usemtl;
+*	everything else is skipped.
+*	@p: start of the chunk (at the start of a line)
+*	@end: end of the chunk (just past a newline or at the end of the file)
+*	@out: receives the geometry of the chunk
+*/
+inline void parse_obj_chunk(const char* p, const char* end, obj_chunk* out) {
+	obj_mesh& m = out->mesh;
+	int material = -1;
+	std::vector<int> cp, ct, cn;
+	std::vector<char> rp, rt, rn;
+
+	while (p < end) {
+		p = skip_blanks(p, end);
+		if (p + 1 < end && p[0] == 'v' && is_blank(p[1])) {
+			p += 2;
+			vec3 v;
+			for (int a = 0; a < 3; a++) {
+				p = skip_blanks(p, end);
+				v[a] = parse_real(p, end);
+			}
+			m.positions.push_back(v);
+		} else if (p + 2 < end && p[0] == 'v' && p[1] == 't' && is_blank(p[2])) {
+			p += 3;
+			for (int a = 0; a < 2; a++) {
+				p = skip_blanks(p, end);
+				m.texcoords.push_back(parse_real(p, end));
+			}
+		} else if (p + 2 < end && p[0] == 'v' && p[1] == 'n' && is_blank(p[2])) {
+			p += 3;
+			vec3 n;
+			for (int a = 0; a < 3; a++) {
+				p = skip_blanks(p, end);
+				n[a] = parse_real(p, end);
+			}
+			m.normals.push_back(n);
+		} else if (p + 1 < end && p[0] == 'f' && is_blank(p[1])) {
+			p += 2;
+			cp.clear(); ct.clear(); cn.clear();
+			rp.clear(); rt.clear(); rn.clear();
+			for (;;) {
+				p = skip_blanks(p, end);
+				if (p >= end || !((*p >= '0' && *p <= '9') || *p == '-' || *p == '+'))
+					break;
+				int a, b, c;
+				bool ra, rb, rc;
+				parse_obj_corner(p, end, *out, a, b, c, ra, rb, rc);
+				cp.push_back(a); ct.push_back(b); cn.push_back(c);
+				rp.push_back(ra); rt.push_back(rb); rn.push_back(rc);
+			}
+			// Fan triangulation: (0, i, i+1)
+			for (size_t i = 1; i + 1 < cp.size(); i++) {
+				size_t corner[3] = { 0, i, i + 1 };
+				for (int k = 0; k < 3; k++) {
+					size_t c = corner[k];
+					if (rp[c]) out->rel_p.push_back(m.indices.size());
+					if (rt[c]) out->rel_t.push_back(m.uv_indices.size());
+					if (rn[c]) out->rel_n.push_back(m.normal_indices.size());
+					m.indices.push_back(cp[c]);
+					m.uv_indices.push_back(ct[c]);
+					m.normal_indices.push_back(cn[c]);
+				}
+				m.face_materials.push_back(material);
+			}
+		} else if (end - p > 7 && memcmp(p, "usemtl", 6) == 0 && is_blank(p[6])) {
+			p = skip_blanks(p + 7, end);
+			const char* name_end = p;
+			while (name_end < end && *name_end != '\n' && *name_end != '\r') name_end++;
+			while (name_end > p && is_blank(name_end[-1])) name_end--;
+			std::string name(p, name_end);
+			material = -1;
+			for (size_t i = 0; i < m.material_names.size(); i++)
+				if (m.material_names[i] == name) material = static_cast<int>(i);
+			if (material < 0) {
+				material = static_cast<int>(m.material_names.size());
+				m.material_names.push_back(name);
+			}
+			p = name_end;
+		}
+		while (p < end && *p != '\n') p++;
+		p++;
+	}
+	out->last_material = material;
+}
+
+/*	Concatenates the chunks in file order into one mesh: relative indices
+*	get the chunk's offset, local material IDs are mapped to global ones
+*	and triangles before a chunk's first usemtl inherit the material that
+*	was active at the end of the previous chunk.
+*	@chunks: the parsed chunks, emptied by the merge
+*	@out: receives the mesh
+*/
+inline void merge_obj_chunks(std::vector<obj_chunk>& chunks, obj_mesh& out) {
+	size_t np = 0, nt = 0, nn = 0, ni = 0, nf = 0;
+	for (size_t c = 0; c < chunks.size(); c++) {
+		np += chunks[c].mesh.positions.size();
+		nt += chunks[c].mesh.texcoords.size();
+		nn += chunks[c].mesh.normals.size();
+		ni += chunks[c].mesh.indices.size();
+		nf += chunks[c].mesh.face_materials.size();
+	}
+	out = obj_mesh();
+	out.positions.reserve(np);
+	out.texcoords.reserve(nt);
+	out.normals.reserve(nn);
+	out.indices.reserve(ni);
+	out.uv_indices.reserve(ni);
+	out.normal_indices.reserve(ni);
+	out.face_materials.reserve(nf);
+
+	std::unordered_map<std::string, int> material_ids;
+	int current = -1;
+	for (size_t c = 0; c < chunks.size(); c++) {
+		obj_chunk& chunk = chunks[c];
+		obj_mesh& m = chunk.mesh;
+		int off_p = static_cast<int>(out.positions.size());
+		int off_t = static_cast<int>(out.texcoords.size() / 2);
+		int off_n = static_cast<int>(out.normals.size());
+		// A relative index still negative after the offset reached back
+		// past the start of the file.
+		for (size_t i = 0; i < chunk.rel_p.size(); i++) {
+			int& k = m.indices[chunk.rel_p[i]];
+			k = k + off_p < 0 ? OBJ_BAD_INDEX : k + off_p;
+		}
+		for (size_t i = 0; i < chunk.rel_t.size(); i++) {
+			int& k = m.uv_indices[chunk.rel_t[i]];
+			k = k + off_t < 0 ? OBJ_BAD_INDEX : k + off_t;
+		}
+		for (size_t i = 0; i < chunk.rel_n.size(); i++) {
+			int& k = m.normal_indices[chunk.rel_n[i]];
+			k = k + off_n < 0 ? OBJ_BAD_INDEX : k + off_n;
+		}
+
+		std::vector<int> global(m.material_names.size());
+		for (size_t i = 0; i < m.material_names.size(); i++) {
+			auto it = material_ids.find(m.material_names[i]);
+			if (it == material_ids.end()) {
+				it = material_ids.insert(std::make_pair(m.material_names[i],
+						static_cast<int>(out.material_names.size()))).first;
+				out.material_names.push_back(m.material_names[i]);
+			}
+			global[i] = it->second;
+		}
+		for (size_t i = 0; i < m.face_materials.size(); i++) {
+			int id = m.face_materials[i];
+			if (id >= 0) current = global[id];
+			out.face_materials.push_back(current);
+		}
+		if (chunk.last_material >= 0)
+			current = global[chunk.last_material];
+
+		out.positions.insert(out.positions.end(), m.positions.begin(), m.positions.end());
+		out.texcoords.insert(out.texcoords.end(), m.texcoords.begin(), m.texcoords.end());
+		out.normals.insert(out.normals.end(), m.normals.begin(), m.normals.end());
+		out.indices.insert(out.indices.end(), m.indices.begin(), m.indices.end());
+		out.uv_indices.insert(out.uv_indices.end(), m.uv_indices.begin(), m.uv_indices.end());
+		out.normal_indices.insert(out.normal_indices.end(), m.normal_indices.begin(), m.normal_indices.end());
+		chunk = obj_chunk();
+	}
+}
+
+/*	Checks that every index of a merged mesh points at an element of it:
+*	positions always, texcoords and normals unless absent (-1).
+*	@m: the merged mesh
+*	@error: receives the first bad triangle and index on failure
+*	returns false if an index is out of range
+*/
+inline bool check_obj_indices(const obj_mesh& m, std::string& error) {
+	const long np = static_cast<long>(m.positions.size());
+	const long nt = static_cast<long>(m.texcoords.size() / 2);
+	const long nn = static_cast<long>(m.normals.size());
+	const char* kind = nullptr;
+	size_t i = 0;
+	for (; i < m.indices.size() && !kind; i++) {
+		if (m.indices[i] < 0 || m.indices[i] >= np)
+			kind = "vertex";
+		else if (m.uv_indices[i] != -1 && (m.uv_indices[i] < 0 || m.uv_indices[i] >= nt))
+			kind = "texcoord";
+		else if (m.normal_indices[i] != -1 && (m.normal_indices[i] < 0 || m.normal_indices[i] >= nn))
+			kind = "normal";
+	}
+	if (!kind)
+		return true;
+	error = "triangle " + std::to_string((i - 1) / 3) + " has a " + kind + " index out of range";
+	return false;
+}
+
+#endif
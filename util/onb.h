@@ -0,0 +1,33 @@
+#ifndef ONB_H
+#define ONB_H
+
+#include "vec3.h"
+
+/*	Orthonormal basis around a unit vector w, for turning directions
+*	sampled around +z (see sample_cosine_hemisphere) into world space.
+*	Built without branches on the sign of w.z (Duff et al. 2017), so it has
+*	no seam and needs no normalization.
+*/
+class onb {
+	public:
+		/*	@n: the unit vector that becomes the local +z
+		*/
+		explicit onb(const vec3& n) : w(n) {
+			real sign = std::copysign(real(1), n.z());
+			real a = -1 / (sign + n.z());
+			real b = n.x() * n.y() * a;
+			u = vec3(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+			v = vec3(b, sign + n.y() * n.y() * a, -n.y());
+		}
+
+		/*	Turns local coordinates into a world-space vector
+		*/
+		vec3 local(const vec3& a) const {
+			return a.x() * u + a.y() * v + a.z() * w;
+		}
+
+	public:
+		vec3 u, v, w;
+};
+
+#endif
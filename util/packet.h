@@ -0,0 +1,57 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include <stdint.h>
+
+#include "util.h"
+
+// Camera rays are traced in square packets of PACKET_DIM x PACKET_DIM
+// neighbouring pixels. Build with -DPACKET_DIM=8 for 8x8 packets.
+#ifndef PACKET_DIM
+#define PACKET_DIM 4
+#endif
+#define PACKET_SIZE (PACKET_DIM*PACKET_DIM)
+
+// One bit per ray of the packet; bit i set means lane i is active.
+typedef uint64_t lane_mask;
+
+/* Returns a mask with the lowest n lanes set
+*/
+inline lane_mask lanes_up_to(int n) {
+	return (n >= 64) ? ~lane_mask(0) : ((lane_mask(1) << n) - 1);
+}
+
+/* Returns the lowest lane set in m, which must not be 0
+*/
+inline int first_lane(lane_mask m) {
+	return __builtin_ctzll(m);
+}
+
+/* A packet of coherent rays stored as structure of arrays so the box and
+*	primitive tests can run over all lanes with straight-line SIMD loops.
+*/
+struct ray_packet {
+	real ox[PACKET_SIZE], oy[PACKET_SIZE], oz[PACKET_SIZE];
+	real dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];
+	real inv_dx[PACKET_SIZE], inv_dy[PACKET_SIZE], inv_dz[PACKET_SIZE];
+
+	/* Stores ray r in lane i
+	*	@i: the lane
+	*	@r: the ray
+	*/
+	void set(int i, const ray& r) {
+		vec3 o = r.origin();
+		vec3 d = r.direction();
+		ox[i] = o[0]; oy[i] = o[1]; oz[i] = o[2];
+		dx[i] = d[0]; dy[i] = d[1]; dz[i] = d[2];
+		inv_dx[i] = 1 / d[0]; inv_dy[i] = 1 / d[1]; inv_dz[i] = 1 / d[2];
+	}
+
+	/* Returns the ray stored in lane i
+	*/
+	ray get(int i) const {
+		return ray(vec3(ox[i], oy[i], oz[i]), vec3(dx[i], dy[i], dz[i]));
+	}
+};
+
+#endif
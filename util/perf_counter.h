@@ -0,0 +1,76 @@
+#ifndef PERF_COUNTER_H
+#define PERF_COUNTER_H
+
+// Hardware cache-miss counter for benchmarking, read through the Linux
+// perf_event_open syscall. Where that is unavailable (other platforms,
+// containers, perf_event_paranoid too high) available() returns false and
+// the counter reads 0, so callers can print "n/a" instead of failing.
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+class cache_miss_counter {
+	public:
+		cache_miss_counter() : fd(-1), total(0) {
+#ifdef __linux__
+			struct perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_CACHE_MISSES;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+		}
+
+		~cache_miss_counter() {
+#ifdef __linux__
+			if (fd >= 0)
+				close(fd);
+#endif
+		}
+
+		bool available() const { return fd >= 0; }
+
+		/*	Starts counting
+		*/
+		void start() {
+#ifdef __linux__
+			if (fd < 0) return;
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+		}
+
+		/*	Stops counting and adds the misses since start() to the total
+		*/
+		void stop() {
+#ifdef __linux__
+			if (fd < 0) return;
+			ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			long long count = 0;
+			if (read(fd, &count, sizeof(count)) == sizeof(count))
+				total += count;
+#endif
+		}
+
+		/*	Returns the misses counted between every start()/stop() pair
+		*/
+		long long misses() const { return total; }
+
+	private:
+		cache_miss_counter(const cache_miss_counter&);
+		cache_miss_counter& operator=(const cache_miss_counter&);
+
+		int fd;
+		long long total;
+};
+
+#endif
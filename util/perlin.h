@@ -33,11 +33,7 @@ class perlin {
             delete[] perm_z;
         }
 
-        double noise(const vec3& msn) const {
-			vec3 p = vec3();
-			p[0] = msn[0];
-			p[1] = msn[1];
-			p[2] = msn[2];
+        double noise(const vec3& p) const {
             auto u = p.x() - floor(p.x());
             auto v = p.y() - floor(p.y());
             auto w = p.z() - floor(p.z());
@@ -7,34 +7,43 @@
 *	@rec: The hit record to store the info
 *	returns true if the ray intersects the plane, false otherwise.
 */
-bool plane::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool plane::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
 	// (p-a) . n = 0
 	// (o + td - a) . n = 0
 	// t = (an - on)/dn = (a-o)n/dn
 	vec3 o = r.origin();
 	vec3 d = r.direction();
-	double denom = dot(d,n);
+	real denom = dot(d,n);
 	//std::cout << denom << std::endl;
 	if (denom > 1e-6 || denom < -1e-6) {
-		double t = dot((p - o),n)/denom;
-		if (t < 0) return false;
+		real t = dot((p - o),n)/denom;
+		if (t < 0 || t < t_min || t_max < t) return false;
 		rec.t = t;
-    	rec.p = r.at(rec.t);
-    	rec.n = normalize(n);
-		rec.kd = kd;
-		rec.mat_ptr = mat_ptr;
+		rec.obj = this;
+		rec.prim_id = 0;
+		rec.mat_id = mat_id;
 		//std::cout << "here" << std::endl;
 		return true;
 	}
 	return false;
 }
 
-/*	Constructs a bounding box for a sphere.
+/* Computes the hit point and normal of the closest hit
+*	@r: Ray that hit the plane
+*	@rec: The hit record to complete
+*/
+void plane::get_surface(const ray& r, hit_record& rec) const {
+	rec.p = r.at(rec.t);
+	rec.n = normalize(n);
+}
+
+/*	A plane is unbounded, so it has no bounding box. Keep planes out of
+*	the BVH and test them next to it (see scene.h).
 *	@time0: t0 time interval for moving objects
 *	@time1: t1 time interval for moving objects
-*	@output_box: output bounding box
-*	Returns an AABB.
+*	@output_box: output bounding box (left untouched)
+*	Returns false.
 */
 bool plane::bounding_box(double time0, double time1, aabb& output_box) const {
-	return true;
+	return false;
 }
@@ -7,17 +7,19 @@
 class plane : public hittable {
     public:
         plane() : kd(vec3(0,0,0)) {}
-        plane(vec3 pu, vec3 nu, vec3 kdu, shared_ptr<material> m) : p(pu), n(nu), kd(kdu), mat_ptr(m) {};
+        plane(vec3 pu, vec3 nu, vec3 kdu, int m) : p(pu), n(nu), kd(kdu), mat_id(m) {};
 
         virtual bool hit(
-            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+            const ray& r, real t_min, real t_max, hit_record& rec) const override;
 		virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+		virtual void get_surface(const ray& r, hit_record& rec) const override;
+		virtual vec3 phong_kd() const override { return kd; }
 
     public:
         vec3 p;
 		vec3 n;
 		vec3 kd;
-		shared_ptr<material> mat_ptr;
+		int mat_id;
 };
 
 #endif
@@ -0,0 +1,186 @@
+#ifndef PLY_PARSE_H
+#define PLY_PARSE_H
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdint.h>
+
+// Reading of binary PLY files (little and big endian). Only the header is
+// parsed as text; the element data is read in place from the mapped file.
+
+enum ply_type { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32,
+				PLY_FLOAT32, PLY_FLOAT64, PLY_INVALID };
+
+/*	Maps a PLY type name (both the old and the sized spellings) to its type
+*/
+inline ply_type ply_type_from_name(const std::string& s) {
+	if (s == "char" || s == "int8") return PLY_INT8;
+	if (s == "uchar" || s == "uint8") return PLY_UINT8;
+	if (s == "short" || s == "int16") return PLY_INT16;
+	if (s == "ushort" || s == "uint16") return PLY_UINT16;
+	if (s == "int" || s == "int32") return PLY_INT32;
+	if (s == "uint" || s == "uint32") return PLY_UINT32;
+	if (s == "float" || s == "float32") return PLY_FLOAT32;
+	if (s == "double" || s == "float64") return PLY_FLOAT64;
+	return PLY_INVALID;
+}
+
+inline int ply_type_size(ply_type t) {
+	static const int sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+	return sizes[t];
+}
+
+inline bool host_is_big_endian() {
+	const uint16_t one = 1;
+	unsigned char first;
+	memcpy(&first, &one, 1);
+	return first == 0;
+}
+
+/*	Reads one value of type t at p, byte-swapping it if swap is set
+*/
+inline double ply_read(const char* p, ply_type t, bool swap) {
+	unsigned char b[8];
+	int n = ply_type_size(t);
+	memcpy(b, p, n);
+	if (swap)
+		for (int i = 0; i < n / 2; i++) std::swap(b[i], b[n-1-i]);
+	switch (t) {
+		case PLY_INT8:    { int8_t v;   memcpy(&v, b, 1); return v; }
+		case PLY_UINT8:   { uint8_t v;  memcpy(&v, b, 1); return v; }
+		case PLY_INT16:   { int16_t v;  memcpy(&v, b, 2); return v; }
+		case PLY_UINT16:  { uint16_t v; memcpy(&v, b, 2); return v; }
+		case PLY_INT32:   { int32_t v;  memcpy(&v, b, 4); return v; }
+		case PLY_UINT32:  { uint32_t v; memcpy(&v, b, 4); return v; }
+		case PLY_FLOAT32: { float v;    memcpy(&v, b, 4); return v; }
+		case PLY_FLOAT64: { double v;   memcpy(&v, b, 8); return v; }
+		default: return 0;
+	}
+}
+
+struct ply_property {
+	std::string name;
+	ply_type type;			// value type (list items for a list)
+	bool is_list;
+	ply_type count_type;	// type of the list length
+};
+
+struct ply_element {
+	std::string name;
+	size_t count;
+	std::vector<ply_property> props;
+
+	/*	Returns the index of a property, -1 if missing
+	*/
+	int find(const std::string& prop) const {
+		for (size_t i = 0; i < props.size(); i++)
+			if (props[i].name == prop) return static_cast<int>(i);
+		return -1;
+	}
+
+	/*	Returns the size of one item, 0 if it has list properties
+	*/
+	size_t stride() const {
+		size_t s = 0;
+		for (size_t i = 0; i < props.size(); i++) {
+			if (props[i].is_list) return 0;
+			s += ply_type_size(props[i].type);
+		}
+		return s;
+	}
+};
+
+struct ply_header {
+	bool big_endian;
+	std::vector<ply_element> elements;
+	size_t data_offset;		// first byte after end_header
+};
+
+/*	Parses the text header of a binary PLY file
+*	@p: start of the file
+*	@end: end of the file
+*	@h: receives the header
+*	@error: receives a message on failure
+*	returns false if this is not a binary PLY file we can read
+*/
+inline bool parse_ply_header(const char* p, const char* end, ply_header& h, std::string& error) {
+	const char* q = p;
+	h.elements.clear();
+	bool have_format = false;
+	bool first = true;
+	while (q < end) {
+		const char* eol = q;
+		while (eol < end && *eol != '\n') eol++;
+		std::string line(q, eol);
+		if (!line.empty() && line[line.size()-1] == '\r') line.erase(line.size()-1);
+		q = (eol < end) ? eol + 1 : eol;
+
+		std::istringstream ss(line);
+		std::string word;
+		ss >> word;
+		if (first) {
+			if (word != "ply") { error = "not a ply file"; return false; }
+			first = false;
+		} else if (word == "format") {
+			std::string fmt;
+			ss >> fmt;
+			if (fmt == "binary_little_endian") h.big_endian = false;
+			else if (fmt == "binary_big_endian") h.big_endian = true;
+			else { error = "unsupported ply format " + fmt + " (only binary is read)"; return false; }
+			have_format = true;
+		} else if (word == "element") {
+			ply_element e;
+			ss >> e.name >> e.count;
+			h.elements.push_back(e);
+		} else if (word == "property") {
+			if (h.elements.empty()) { error = "property before element"; return false; }
+			ply_property prop;
+			std::string type;
+			ss >> type;
+			prop.is_list = (type == "list");
+			if (prop.is_list) {
+				std::string count_type, item_type;
+				ss >> count_type >> item_type;
+				prop.count_type = ply_type_from_name(count_type);
+				prop.type = ply_type_from_name(item_type);
+				if (prop.count_type == PLY_INVALID) { error = "bad list type " + count_type; return false; }
+			} else {
+				prop.type = ply_type_from_name(type);
+				prop.count_type = PLY_INVALID;
+			}
+			if (prop.type == PLY_INVALID) { error = "bad property type in: " + line; return false; }
+			ss >> prop.name;
+			h.elements.back().props.push_back(prop);
+		} else if (word == "end_header") {
+			if (!have_format) { error = "missing format line"; return false; }
+			h.data_offset = q - p;
+			return true;
+		}
+		// comment, obj_info: ignored
+	}
+	error = "missing end_header";
+	return false;
+}
+
+/*	Skips one item of element e at p (used for items with list properties)
+*	returns the position after the item, or NULL if it runs past end
+*/
+inline const char* ply_skip_item(const char* p, const char* end, const ply_element& e, bool swap) {
+	for (size_t i = 0; i < e.props.size(); i++) {
+		const ply_property& prop = e.props[i];
+		if (prop.is_list) {
+			if (p + ply_type_size(prop.count_type) > end) return NULL;
+			size_t n = static_cast<size_t>(ply_read(p, prop.count_type, swap));
+			p += ply_type_size(prop.count_type) + n * ply_type_size(prop.type);
+		} else {
+			p += ply_type_size(prop.type);
+		}
+		if (p > end) return NULL;
+	}
+	return p;
+}
+
+#endif
@@ -1,5 +1,7 @@
 #include <cmath>
 #include <iostream>
+#include <cstring>
+#include <stdint.h>
 #include "ray.h"
 
 /* Empty Constructor
@@ -36,6 +38,55 @@ vec3 ray::origin() const {
 *	@t: the time value
 *	returns the point on the ray at time t.
 */
-vec3 ray::at(double t) const {
+vec3 ray::at(real t) const {
 	return o + (t*d);
 }
+
+
+// Integer type with the same width as real, used to step a coordinate
+// by a whole number of ulps.
+#ifdef SINGLE_PRECISION
+typedef int32_t real_bits;
+#else
+typedef int64_t real_bits;
+#endif
+
+/* Moves a single coordinate of a hit point by int_offset ulps (or by
+*	float_offset when the coordinate is close to zero, where ulps are tiny).
+*	@p: coordinate to move
+*	@n: the matching normal component
+*	returns the offset coordinate
+*/
+static real offset_coordinate(real p, real n) {
+	const real origin = 1.0 / 32.0;
+	const real float_scale = 1.0 / 65536.0;
+	const real int_scale = 256.0;
+
+	if (fabs(p) < origin)
+		return p + float_scale*n;
+
+	real_bits of = static_cast<real_bits>(int_scale*n);
+	real_bits bits;
+	std::memcpy(&bits, &p, sizeof(real));
+	bits += (p < 0) ? -of : of;
+	real ret;
+	std::memcpy(&ret, &bits, sizeof(real));
+	return ret;
+}
+
+/* Offsets a hit point along the surface normal so a ray spawned from it
+*	cannot re-intersect the surface it starts on. The offset scales with the
+*	magnitude of the point, which keeps it robust in single precision
+*	(Waechter and Binder, "A Fast and Robust Method for Avoiding
+*	Self-Intersection", Ray Tracing Gems).
+*	@p: the hit point
+*	@n: the surface normal at p
+*	@dir: direction of the ray leaving p, picks the side to offset towards
+*	returns the offset origin
+*/
+vec3 offset_ray_origin(const vec3& p, const vec3& n, const vec3& dir) {
+	vec3 side = (dot(n, dir) < 0) ? -n : n;
+	return vec3(offset_coordinate(p[0], side[0]),
+				offset_coordinate(p[1], side[1]),
+				offset_coordinate(p[2], side[2]));
+}
\ No newline at end of file
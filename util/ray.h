@@ -14,7 +14,9 @@ class ray {
 
 		vec3 direction() const;
 		vec3 origin() const;
-		vec3 at(double t) const;
+		vec3 at(real t) const;
 };
 
+vec3 offset_ray_origin(const vec3& p, const vec3& n, const vec3& dir);
+
 #endif
@@ -0,0 +1,275 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+
+#include "util.h"
+
+// Which sampler the renderers use: sampler::sobol, sampler::halton,
+// sampler::cmj or sampler::independent (e.g. -DSAMPLER_KIND=sampler::cmj).
+#ifndef SAMPLER_KIND
+#define SAMPLER_KIND sampler::sobol
+#endif
+
+// Correlated multi-jittered patterns kept in the table; every pixel and
+// dimension pair uses one of them, with its samples in its own order.
+#define CMJ_PATTERNS 64
+
+// Halton uses one prime base per dimension for this many dimensions;
+// dimensions past them get independent random numbers.
+#define HALTON_DIMENSIONS 32
+
+// Layout of the dimensions of one path sample. Dimensions are used in
+// pairs (2k, 2k + 1), which the samplers stratify together.
+enum sample_dimension {
+	SAMPLE_PIXEL = 0,		// 2: position in the pixel
+	SAMPLE_LENS = 2,		// 2: position on the lens
+	SAMPLE_BOUNCE = 4,		// first dimension of bounce 0
+	SAMPLES_PER_BOUNCE = 6
+};
+
+// Offsets of the dimensions within one bounce.
+enum bounce_dimension {
+	BOUNCE_DIRECTION = 0,	// 2: scattered direction
+	BOUNCE_CHOICE = 2,		// reflect or refract
+	BOUNCE_LIGHT = 3,		// which light to sample
+	BOUNCE_LIGHT_POINT = 4	// 2: point on the light
+};
+
+/*	Integer hash with good avalanche (the "lowbias32" finalizer).
+*/
+inline uint32_t hash_uint(uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t v) {
+	return hash_uint(seed ^ (v + 0x9e3779b9U + (seed << 6) + (seed >> 2)));
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+	x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+	x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+	x = ((x >> 4) & 0x0F0F0F0FU) | ((x & 0x0F0F0F0FU) << 4);
+	x = ((x >> 8) & 0x00FF00FFU) | ((x & 0x00FF00FFU) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+/*	Owen scrambling of a 32-bit fixed point number in [0,1): every bit is
+*	flipped depending on the bits above it and the seed (Burley 2020, with
+*	the Laine-Karras hash).
+*/
+inline uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+	x = reverse_bits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cU;
+	x ^= x * 0xb82f1e52U;
+	x ^= x * 0xc7afe638U;
+	x ^= x * 0x8d22f6e6U;
+	return reverse_bits(x);
+}
+
+/*	Random permutation of [0, l) evaluated one element at a time, from
+*	Kensler's "Correlated Multi-Jittered Sampling" (2013).
+*	@i: the element
+*	@l: the length
+*	@p: the seed that picks the permutation
+*/
+inline uint32_t permute(uint32_t i, uint32_t l, uint32_t p) {
+	uint32_t w = l - 1;
+	w |= w >> 1;
+	w |= w >> 2;
+	w |= w >> 4;
+	w |= w >> 8;
+	w |= w >> 16;
+	do {
+		i ^= p; i *= 0xe170893dU;
+		i ^= p >> 16;
+		i ^= (i & w) >> 4;
+		i ^= p >> 8; i *= 0x0929eb3fU;
+		i ^= p >> 23;
+		i ^= (i & w) >> 1; i *= 1 | p >> 27;
+		i *= 0x6935fa69U;
+		i ^= (i & w) >> 11; i *= 0x74dcb303U;
+		i ^= (i & w) >> 2; i *= 0x9e501cc3U;
+		i ^= (i & w) >> 2; i *= 0xc860a3dfU;
+		i &= w;
+		i ^= i >> 5;
+	} while (i >= l);
+	return (i + p) % l;
+}
+
+/*	Turns 32 random bits into a real in [0,1).
+*/
+inline real fixed_to_real(uint32_t x) {
+	return std::min(real(x) * real(1.0 / 4294967296.0), real(1) - std::numeric_limits<real>::epsilon());
+}
+
+/*	Sample generator for the whole render. Everything that depends only on
+*	the sample count is built once in the constructor; get() is then a
+*	table lookup plus a few hashes, so it allocates nothing and can be
+*	called from any thread. Samples of different pixels and dimension pairs
+*	are decorrelated by hashing the pixel and pair into scrambling seeds.
+*		sobol:       the (0,2)-sequence of Sobol's first two dimensions for
+*		             every pair, Owen-scrambled, and the sample order
+*		             shuffled per pixel and pair
+*		halton:      radical inverses in the first HALTON_DIMENSIONS prime
+*		             bases, shifted per pixel (Cranley-Patterson)
+*		cmj:         Kensler's correlated multi-jittered patterns
+*		independent: hashed random numbers, the reference
+*/
+class sampler {
+	public:
+		enum kind { independent, sobol, halton, cmj };
+
+		/*	@k: the kind of sampler
+		*	@samples_per_pixel: the sample count, which sizes the tables
+		*	@seedu: changes every number, e.g. per frame
+		*/
+		sampler(kind k, int samples_per_pixel, uint32_t seedu = 0)
+			: type(k), spp(std::max(samples_per_pixel, 1)), seed(hash_uint(seedu)) {
+			switch (type) {
+				case sobol: {
+					table.resize(2 * static_cast<size_t>(spp));
+					for (uint32_t i = 0; i < spp; i++) {
+						uint32_t y = 0;
+						for (uint32_t v = 1U << 31, b = i; b; b >>= 1, v ^= v >> 1)
+							if (b & 1) y ^= v;
+						table[2*i] = reverse_bits(i);
+						table[2*i + 1] = y;
+					}
+					break;
+				}
+
+				case halton: {
+					static const uint32_t primes[HALTON_DIMENSIONS] = {
+						2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+						59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131 };
+					table.resize(HALTON_DIMENSIONS * static_cast<size_t>(spp));
+					for (int d = 0; d < HALTON_DIMENSIONS; d++)
+						for (uint32_t i = 0; i < spp; i++) {
+							double inv = 1.0 / primes[d], f = inv, r = 0;
+							for (uint32_t n = i; n; n /= primes[d], f *= inv)
+								r += (n % primes[d]) * f;
+							table[d * spp + i] = static_cast<uint32_t>(r * 4294967296.0);
+						}
+					break;
+				}
+
+				case cmj: {
+					// Kensler's cmj(): an m x n jittered grid whose columns and rows
+					// are shuffled together, so it is stratified in 1D and 2D.
+					uint32_t m = static_cast<uint32_t>(std::sqrt(double(spp)));
+					while (m * m > spp) m--;
+					while ((m + 1) * (m + 1) <= spp) m++;
+					uint32_t n = (spp + m - 1) / m;
+					table.resize(CMJ_PATTERNS * 2 * static_cast<size_t>(spp));
+					for (uint32_t p = 0; p < CMJ_PATTERNS; p++) {
+						uint32_t ps = hash_combine(seed, p);
+						for (uint32_t s = 0; s < spp; s++) {
+							uint32_t sx = permute(s % m, m, ps * 0xa511e9b3U);
+							uint32_t sy = permute(s / m, n, ps * 0x63d83595U);
+							double jx = fixed_to_real(hash_combine(ps * 0xa399d265U, s));
+							double jy = fixed_to_real(hash_combine(ps * 0x711ad6a5U, s));
+							double x = (s % m + (sy + jx) / n) / m;
+							double y = (s / m + (sx + jy) / m) / n;
+							table[(p * spp + s) * 2] = static_cast<uint32_t>(std::min(x, 1.0) * 4294967295.0);
+							table[(p * spp + s) * 2 + 1] = static_cast<uint32_t>(std::min(y, 1.0) * 4294967295.0);
+						}
+					}
+					break;
+				}
+
+				case independent:
+				default:
+					break;
+			}
+		}
+
+		/*	Returns one number of a sample
+		*	@pixel: j * width + i
+		*	@sample: which sample of the pixel, below the count given to the
+		*	constructor for the stratification to hold
+		*	@dim: the dimension, see sample_dimension
+		*/
+		real get(uint32_t pixel, uint32_t sample, uint32_t dim) const {
+			const uint32_t pair = dim >> 1;
+			const uint32_t axis = dim & 1;
+			const uint32_t key = hash_combine(hash_combine(seed, pixel), pair);
+			switch (type) {
+				case sobol: {
+					uint32_t i = permute(sample % spp, spp, key);
+					return fixed_to_real(owen_scramble(table[2*i + axis], hash_combine(key, axis)));
+				}
+
+				case halton: {
+					if (dim >= HALTON_DIMENSIONS)
+						break;
+					uint32_t shift = hash_combine(hash_combine(seed, pixel), dim + 0x40000000U);
+					return fixed_to_real(table[dim * spp + sample % spp] + shift);
+				}
+
+				case cmj: {
+					uint32_t p = key % CMJ_PATTERNS;
+					uint32_t i = permute(sample % spp, spp, key >> 6);
+					return fixed_to_real(table[(p * spp + i) * 2 + axis]);
+				}
+
+				case independent:
+				default:
+					break;
+			}
+			return fixed_to_real(hash_combine(hash_combine(key, sample), axis));
+		}
+
+		const kind type;
+
+	private:
+		const uint32_t spp;
+		const uint32_t seed;
+		std::vector<uint32_t> table;	// 32-bit fixed point values, see the constructor
+};
+
+/*	The dimensions of one path sample. Each bounce gets its own block of
+*	SAMPLES_PER_BOUNCE dimensions, used at fixed offsets (bounce_dimension)
+*	whatever the material, so a dimension means the same thing in every
+*	sample. Without a sampler it falls back to random_double().
+*/
+struct sample_stream {
+	sample_stream() : s(nullptr), pixel(0), sample(0), bounces(0), base(SAMPLE_BOUNCE) {}
+
+	/*	@su: the sampler, or null for random_double()
+	*	@pixelu: j * width + i
+	*	@sampleu: which sample of the pixel
+	*	@first_bounce: the bounce the first next_bounce() moves to
+	*/
+	sample_stream(const sampler* su, uint32_t pixelu, uint32_t sampleu, int first_bounce = 0)
+		: s(su), pixel(pixelu), sample(sampleu), bounces(first_bounce), base(SAMPLE_BOUNCE) {}
+
+	/*	Moves on to the dimensions of the next bounce
+	*/
+	void next_bounce() {
+		base = SAMPLE_BOUNCE + SAMPLES_PER_BOUNCE * bounces++;
+	}
+
+	/*	Returns a number of the current bounce
+	*	@offset: see bounce_dimension
+	*/
+	real get(uint32_t offset) const {
+		return s ? s->get(pixel, sample, base + offset) : random_double();
+	}
+
+	const sampler* s;
+	uint32_t pixel;
+	uint32_t sample;
+	uint32_t bounces;
+	uint32_t base;
+};
+
+#endif
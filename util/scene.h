@@ -0,0 +1,115 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <vector>
+#include <algorithm>
+
+#include "util.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "bvh.h"
+
+/*	Top level of the scene: a BVH over the ordinary primitives next to a
+*	short list of primitives that do not belong in a BVH, which are tested
+*	analytically on every ray. A primitive goes in that list if it has no
+*	bounding box (a plane) or if its box diagonal is more than huge_factor
+*	times the median diagonal (a ground sphere of radius 1000), since a box
+*	that swallows the whole scene makes every BVH node above it useless.
+*/
+class scene : public hittable {
+	public:
+		scene() {}
+
+		/*	Splits list into BVH and unbounded primitives and builds the BVH.
+		*	@list: the objects in the world
+		*	@time0: t0 for moving objects
+		*	@time1: t1 for moving objects
+		*	@k: max depth of the BVH
+		*	@mem: arena to place the BVH nodes in, or null to use the heap
+		*	@huge_factor: box diagonal, relative to the median, past which a
+		*	primitive is kept out of the BVH
+		*/
+		scene(const hittable_list& list, double time0, double time1, int k,
+			  arena* mem = nullptr, real huge_factor = 50) {
+			std::vector<real> diagonals;
+			std::vector<shared_ptr<hittable>> bounded;
+			for (const auto& object : list.objects) {
+				aabb box;
+				if (!object->bounding_box(time0, time1, box)) {
+					unbounded.add(object);
+					continue;
+				}
+				bounded.push_back(object);
+				diagonals.push_back((box.max() - box.min()).length());
+			}
+
+			if (!diagonals.empty()) {
+				std::vector<real> sorted = diagonals;
+				std::nth_element(sorted.begin(), sorted.begin() + sorted.size()/2, sorted.end());
+				real limit = huge_factor * sorted[sorted.size()/2];
+
+				std::vector<shared_ptr<hittable>> rest;
+				for (size_t i = 0; i < bounded.size(); i++) {
+					if (diagonals[i] > limit)
+						unbounded.add(bounded[i]);
+					else
+						rest.push_back(bounded[i]);
+				}
+				if (!rest.empty())
+					bvh = make_in<bvh_node>(mem, &rest, 0, rest.size(), time0, time1, k, mem);
+			}
+		}
+
+		virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+		virtual void hit_packet(
+			const ray_packet& p, real t_min, packet_hits& hits, lane_mask active) const override;
+		virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+
+	public:
+		shared_ptr<bvh_node> bvh;
+		hittable_list unbounded;
+};
+
+/*	Determines if the ray hits anything in the scene. The BVH goes first so
+*	its closest hit can cull the unbounded primitives.
+*	@r: ray to cast
+*	@t_min: min value of t
+*	@t_max: max value of t
+*	@rec: hit record to store the info
+*/
+bool scene::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	bool hit_bvh = bvh && bvh->hit(r, t_min, t_max, rec);
+	bool hit_unbounded = unbounded.hit(r, t_min, hit_bvh ? rec.t : t_max, rec);
+	return hit_bvh || hit_unbounded;
+}
+
+/*	Intersects a ray packet with the BVH and then the unbounded primitives.
+*	@p: ray packet to cast
+*	@t_min: min value of t
+*	@hits: per-lane hit records, updated with closer hits
+*	@active: the lanes to test
+*/
+void scene::hit_packet(const ray_packet& p, real t_min, packet_hits& hits, lane_mask active) const {
+	if (bvh)
+		bvh->hit_packet(p, t_min, hits, active);
+	unbounded.hit_packet(p, t_min, hits, active);
+}
+
+/*	Constructs a bounding box for the scene.
+*	@time0: t0 time interval for moving objects
+*	@time1: t1 time interval for moving objects
+*	@output_box: output bounding box
+*	Returns false if the scene contains a primitive without a bounding box.
+*/
+bool scene::bounding_box(double time0, double time1, aabb& output_box) const {
+	aabb bvh_box;
+	if (unbounded.objects.empty())
+		return bvh && bvh->bounding_box(time0, time1, output_box);
+	if (!unbounded.bounding_box(time0, time1, output_box))
+		return false;
+	if (bvh && bvh->bounding_box(time0, time1, bvh_box))
+		output_box = surrounding_box(output_box, bvh_box);
+	return true;
+}
+
+#endif
@@ -7,19 +7,19 @@
 *	@rec: The hit record to store the info
 *	returns true if the ray intersects the spheres, and false otherwise.
 */
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-	double root = -1000000000000;
+bool sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	real root = -1000000000000;
     vec3 oc = r.origin() - center;
-	double a = dot(r.direction(),r.direction());
-	double b = 2* dot(oc, r.direction());
-	double c = dot(oc,oc) - radius*radius;
+	real a = dot(r.direction(),r.direction());
+	real b = 2* dot(oc, r.direction());
+	real c = dot(oc,oc) - radius*radius;
 
 	vec3 d = r.direction();
-	double m = 4 * dot(d,d); // 4d^2
+	real m = 4 * dot(d,d); // 4d^2
 	vec3 n1 = oc - (dot(oc,d) * d);
-	double n2 = dot(n1,n1);
-	double discriminant = m * (radius*radius - n2); 
-	//double discriminant = (b*b) - (4*a*c);	// can lead to loss of accuracy
+	real n2 = dot(n1,n1);
+	real discriminant = m * (radius*radius - n2); 
+	//real discriminant = (b*b) - (4*a*c);	// can lead to loss of accuracy
 
 	if (discriminant < 0) {
 		return false;
@@ -42,12 +42,21 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
 
 	//std::cout << "root = " << root << std::endl;
     rec.t = root;
+	rec.obj = this;
+	rec.prim_id = 0;
+	rec.mat_id = mat_id;
+    return true;
+}
+
+/*	Computes the hit point, normal and texture coordinates of the closest
+*	hit. Kept out of hit() because get_sphere_uv costs an acos and an atan2.
+*	@r: the ray that hit the sphere
+*	@rec: the hit record to complete
+*/
+void sphere::get_surface(const ray& r, hit_record& rec) const {
     rec.p = r.at(rec.t);
     rec.n = (rec.p - center) / radius;
-	rec.kd = kd;
-	get_sphere_uv(outward_normal, rec.u, rec.v);
-	rec.mat_ptr = mat_ptr;
-    return true;
+	get_sphere_uv(rec.n, rec.u, rec.v);
 }
 
 /*	Constructs a bounding box for a sphere.
@@ -7,18 +7,20 @@
 class sphere : public hittable {
     public:
         sphere() : kd(vec3(0,0,0)) {}
-        sphere(vec3 cen, double r, vec3 kdu, shared_ptr<material> m) : center(cen), radius(r), kd(kdu), mat_ptr(m) {};
+        sphere(vec3 cen, real r, vec3 kdu, int m) : center(cen), radius(r), kd(kdu), mat_id(m) {};
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
 		virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+		virtual void get_surface(const ray& r, hit_record& rec) const override;
+		virtual vec3 phong_kd() const override { return kd; }
 
     private:
         vec3 center;
-        double radius;
+        real radius;
 		vec3 kd;
-		shared_ptr<material> mat_ptr;
+		int mat_id;
 
-		static void get_sphere_uv(const vec3& p, double& u, double& v) {
+		static void get_sphere_uv(const vec3& p, real& u, real& v) {
             // p: a given point on the sphere of radius one, centered at the origin.
             // u: returned value [0,1] of angle around the Y axis from X=-1.
             // v: returned value [0,1] of angle from Y=-1 to Y=+1.
@@ -0,0 +1,568 @@
+#ifndef STREAMED_MESH_H
+#define STREAMED_MESH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "util.h"
+#include "hittable.h"
+#include "compressed_mesh.h"
+#include "mapped_file.h"
+
+// Cluster blobs start on multiples of this, so evicting one can drop its
+// pages from the mapping without touching its neighbours.
+#define CLUSTER_FILE_ALIGN 4096
+
+struct cluster_file_header {
+	char magic[8];				// "RTCLUST"
+	uint32_t version;
+	uint32_t real_size;
+	uint64_t clusters;
+	uint64_t triangles;
+};
+
+struct cluster_entry {
+	real lo[3], hi[3];			// bounds of the cluster
+	uint64_t offset;			// of the compressed_mesh blob in the file
+	uint64_t bytes;
+	uint32_t first_triangle;	// global index of the cluster's triangle 0
+	uint32_t triangles;
+};
+
+/*	Writes a mesh as an out-of-core cluster file: the triangles are split
+*	at the median centroid along the widest axis until each part has at
+*	most cluster_triangles, and every part becomes a compressed_mesh (so
+*	its positions are quantized to its own, much smaller bounds) with its
+*	own BVH. The file starts with a table of the cluster bounds; the
+*	clusters follow as page-aligned blobs.
+*	@path: the file to write
+*	@positions: vertex positions
+*	@indices: 0-based vertex indices, 3 per triangle
+*	@normals: unit normal per vertex, or empty for flat shading
+*	@mat_id: material ID of the mesh
+*	@kd, @ks: phong colors
+*	@cluster_triangles: max triangles per cluster
+*	@error: receives a message on failure
+*	returns false if the file could not be written
+*/
+inline bool write_cluster_file(const char* path, const std::vector<vec3>& positions,
+							   const std::vector<int>& indices, const std::vector<vec3>& normals,
+							   int mat_id, vec3 kd, vec3 ks, int cluster_triangles, std::string& error) {
+	const size_t faces = indices.size() / 3;
+	std::vector<int> order(faces);
+	std::vector<vec3> centroid(faces);
+	for (size_t f = 0; f < faces; f++) {
+		order[f] = static_cast<int>(f);
+		centroid[f] = (positions[indices[3*f]] + positions[indices[3*f+1]] + positions[indices[3*f+2]]) / 3;
+	}
+
+	// Median splits, leaves in left-to-right order.
+	std::vector<std::pair<int, int> > ranges;
+	std::vector<std::pair<int, int> > stack(1, std::make_pair(0, static_cast<int>(faces)));
+	while (!stack.empty()) {
+		std::pair<int, int> r = stack.back();
+		stack.pop_back();
+		if (r.second - r.first <= std::max(cluster_triangles, 1)) {
+			if (r.second > r.first)
+				ranges.push_back(r);
+			continue;
+		}
+		vec3 cmin = centroid[order[r.first]], cmax = cmin;
+		for (int i = r.first + 1; i < r.second; i++)
+			for (int a = 0; a < 3; a++) {
+				cmin[a] = std::min(cmin[a], centroid[order[i]][a]);
+				cmax[a] = std::max(cmax[a], centroid[order[i]][a]);
+			}
+		vec3 extent = cmax - cmin;
+		int axis = 0;
+		if (extent[1] > extent[axis]) axis = 1;
+		if (extent[2] > extent[axis]) axis = 2;
+		int mid = r.first + (r.second - r.first) / 2;
+		std::nth_element(order.begin() + r.first, order.begin() + mid, order.begin() + r.second,
+			[&centroid, axis](int a, int b) { return centroid[a][axis] < centroid[b][axis]; });
+		stack.push_back(std::make_pair(mid, r.second));
+		stack.push_back(std::make_pair(r.first, mid));
+	}
+
+	FILE* f = fopen(path, "wb");
+	if (!f) {
+		error = std::string("cannot create ") + path;
+		return false;
+	}
+
+	cluster_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "RTCLUST", 8);
+	header.version = 1;
+	header.real_size = sizeof(real);
+	header.clusters = ranges.size();
+	header.triangles = faces;
+	std::vector<cluster_entry> table(ranges.size());
+
+	const size_t table_end = sizeof(header) + table.size() * sizeof(cluster_entry);
+	uint64_t at = (table_end + CLUSTER_FILE_ALIGN - 1) / CLUSTER_FILE_ALIGN * CLUSTER_FILE_ALIGN;
+	std::vector<int> local(positions.size(), -1);
+	std::vector<char> blob;
+	bool ok = true;
+	uint32_t first = 0;
+	for (size_t c = 0; c < ranges.size() && ok; c++) {
+		std::vector<vec3> p, n;
+		std::vector<int> idx;
+		std::vector<int> used;
+		for (int i = ranges[c].first; i < ranges[c].second; i++)
+			for (int k = 0; k < 3; k++) {
+				int v = indices[3 * order[i] + k];
+				if (local[v] < 0) {
+					local[v] = static_cast<int>(p.size());
+					used.push_back(v);
+					p.push_back(positions[v]);
+					if (!normals.empty())
+						n.push_back(normals[v]);
+				}
+				idx.push_back(local[v]);
+			}
+		for (size_t i = 0; i < used.size(); i++)
+			local[used[i]] = -1;
+
+		compressed_mesh mesh(p, idx, n, mat_id, kd, ks);
+		blob.clear();
+		mesh.serialize(blob);
+		aabb box;
+		mesh.bounding_box(0, 1, box);
+
+		cluster_entry& e = table[c];
+		for (int a = 0; a < 3; a++) {
+			e.lo[a] = box.min()[a];
+			e.hi[a] = box.max()[a];
+		}
+		e.offset = at;
+		e.bytes = blob.size();
+		e.first_triangle = first;
+		e.triangles = static_cast<uint32_t>(ranges[c].second - ranges[c].first);
+		first += e.triangles;
+
+		ok = fseek(f, static_cast<long>(at), SEEK_SET) == 0
+			&& fwrite(blob.data(), 1, blob.size(), f) == blob.size();
+		at = (at + blob.size() + CLUSTER_FILE_ALIGN - 1) / CLUSTER_FILE_ALIGN * CLUSTER_FILE_ALIGN;
+	}
+
+	ok = ok && fseek(f, 0, SEEK_SET) == 0
+		&& fwrite(&header, sizeof(header), 1, f) == 1
+		&& (table.empty() || fwrite(table.data(), sizeof(cluster_entry), table.size(), f) == table.size());
+	ok = (fclose(f) == 0) && ok;
+	if (!ok)
+		error = std::string("writing ") + path + " failed";
+	return ok;
+}
+
+/*	Page-in counters of a streamed_mesh.
+*/
+struct streamed_stats {
+	unsigned long page_ins = 0;		// clusters read from the file
+	unsigned long evictions = 0;	// clusters dropped to stay in budget
+	unsigned long reuses = 0;		// requests for an already resident cluster
+	unsigned long long bytes_in = 0;
+	size_t resident_peak = 0;		// bytes
+	double load_seconds = 0;
+
+	/*	Prints the counters
+	*	@out: the stream to print to
+	*/
+	void print(std::ostream& out) const {
+		out << "streamed geometry: " << page_ins << " page-ins (" << bytes_in / 1e6 << " MB, "
+			<< load_seconds * 1000 << " ms), " << evictions << " evictions, " << reuses
+			<< " resident hits, peak " << resident_peak / 1e6 << " MB resident\n";
+	}
+};
+
+/*	A mesh that stays on disk. The cluster file is memory-mapped, only the
+*	table of cluster bounds is read up front, and a cluster's compressed
+*	mesh is paged in (copied out of the mapping) the first time a ray
+*	reaches its bounds. Resident clusters are kept under a byte budget by
+*	evicting the least recently used one, whose mapped pages are dropped
+*	as well, so memory stays bounded however large the file is.
+*
+*	hit() loads what it needs on the spot. The wavefront integrator does
+*	better: it asks hit_resident() for the clusters a ray still needs,
+*	queues the ray on each of them and runs the queues one cluster at a
+*	time, so every cluster is paged in at most once per bounce.
+*
+*	The global triangle index is stored in rec.prim_id.
+*/
+class streamed_mesh : public hittable {
+	public:
+		/*	Maps the file and reads the cluster table. Check ok() afterwards.
+		*	@path: a file written by write_cluster_file
+		*	@budget_bytes: max bytes of resident clusters; the cluster being
+		*	used is always kept, even if it alone is larger
+		*/
+		streamed_mesh(const char* path, size_t budget_bytes)
+			: file(path, false), resident_bytes(0), budget(budget_bytes) {
+			if (!file.ok()) {
+				error = std::string("cannot open ") + path;
+				return;
+			}
+			cluster_file_header h;
+			if (file.size() < sizeof(h)) {
+				error = "not a cluster file";
+				return;
+			}
+			memcpy(&h, file.data(), sizeof(h));
+			if (memcmp(h.magic, "RTCLUST", 8) != 0 || h.version != 1) {
+				error = "not a cluster file";
+				return;
+			}
+			if (h.real_size != sizeof(real)) {
+				error = "cluster file was written by a build with another precision";
+				return;
+			}
+			if (file.size() < sizeof(h) + h.clusters * sizeof(cluster_entry)) {
+				error = "cluster table is truncated";
+				return;
+			}
+			entries.resize(h.clusters);
+			if (!entries.empty())
+				memcpy(entries.data(), file.data() + sizeof(h), entries.size() * sizeof(cluster_entry));
+			for (size_t c = 0; c < entries.size(); c++) {
+				if (entries[c].offset + entries[c].bytes > file.size()) {
+					error = "cluster data is truncated";
+					entries.clear();
+					return;
+				}
+			}
+			slots.resize(entries.size());
+			lru_pos.resize(entries.size(), lru.end());
+
+			std::vector<int> order(entries.size());
+			for (size_t c = 0; c < order.size(); c++)
+				order[c] = static_cast<int>(c);
+			if (!order.empty())
+				build_node(order, 0, static_cast<int>(order.size()));
+			cluster_order.swap(order);
+		}
+
+		bool ok() const { return error.empty(); }
+		const std::string& last_error() const { return error; }
+		size_t clusters() const { return entries.size(); }
+
+		virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+		virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+		virtual void get_surface(const ray& r, hit_record& rec) const override;
+
+		/*	Intersects the clusters that are already resident and lists the
+		*	others the ray reaches before t_max. Never pages anything in.
+		*	@pending: receives the missing clusters with the ray's entry
+		*	distance into each, nearest first (appended)
+		*	returns true if a resident cluster was hit; rec.t is then the
+		*	closest, and pending may still hold clusters with a closer hit
+		*/
+		bool hit_resident(const ray& r, real t_min, real t_max, hit_record& rec,
+						  std::vector<std::pair<real, int> >& pending) const;
+
+		/*	Pages cluster c in if needed and intersects it
+		*	returns true if the ray hits cluster c closer than t_max
+		*/
+		bool hit_cluster(int c, const ray& r, real t_min, real t_max, hit_record& rec) const;
+
+		streamed_stats stats() const {
+			std::lock_guard<std::mutex> lock(mutex);
+			return counters;
+		}
+
+	private:
+		streamed_mesh(const streamed_mesh&);
+		streamed_mesh& operator=(const streamed_mesh&);
+
+		// Flat BVH over the cluster bounds (always resident), laid out as in
+		// sphere_set; a leaf holds count clusters of cluster_order.
+		struct node {
+			real lo[3], hi[3];
+			int index;
+			int count;		// 0 for interior nodes
+		};
+
+		void build_node(std::vector<int>& order, int start, int end);
+		void candidates(const ray& r, real t_min, real t_max, std::vector<std::pair<real, int> >& out) const;
+
+		/*	Entry distance of the ray into the box, or infinity if it misses
+		*	the box within [t_min, t_max]
+		*/
+		static real entry(const real* lo, const real* hi, const ray& r, real t_min, real t_max) {
+			for (int a = 0; a < 3; a++) {
+				real inv = 1 / r.direction()[a];
+				real t0 = (lo[a] - r.origin()[a]) * inv;
+				real t1 = (hi[a] - r.origin()[a]) * inv;
+				if (inv < 0)
+					std::swap(t0, t1);
+				t_min = t0 > t_min ? t0 : t_min;
+				t_max = t1 < t_max ? t1 : t_max;
+				if (t_max < t_min)
+					return infinity;
+			}
+			return t_min;
+		}
+
+		shared_ptr<compressed_mesh> acquire(int c) const;
+		bool hit_mesh(int c, const compressed_mesh& m, const ray& r, real t_min, real t_max,
+					  hit_record& rec) const;
+
+		mapped_file file;
+		std::string error;
+		std::vector<cluster_entry> entries;
+		std::vector<node> nodes;
+		std::vector<int> cluster_order;
+
+		// Residency, guarded by mutex so hit() stays usable from threads.
+		mutable std::mutex mutex;
+		mutable std::vector<shared_ptr<compressed_mesh> > slots;	// null if not resident
+		mutable std::list<int> lru;									// most recent first
+		mutable std::vector<std::list<int>::iterator> lru_pos;
+		mutable size_t resident_bytes;
+		size_t budget;
+		mutable streamed_stats counters;
+};
+
+/*	Recursively builds the cluster BVH over order[start, end), splitting at
+*	the median box center along the widest axis.
+*/
+void streamed_mesh::build_node(std::vector<int>& order, int start, int end) {
+	int self = static_cast<int>(nodes.size());
+	nodes.push_back(node());
+	real lo[3], hi[3], cmin[3], cmax[3];
+	for (int a = 0; a < 3; a++) {
+		lo[a] = cmin[a] = infinity;
+		hi[a] = cmax[a] = -infinity;
+	}
+	for (int i = start; i < end; i++) {
+		const cluster_entry& e = entries[order[i]];
+		for (int a = 0; a < 3; a++) {
+			lo[a] = std::min(lo[a], e.lo[a]);
+			hi[a] = std::max(hi[a], e.hi[a]);
+			cmin[a] = std::min(cmin[a], (e.lo[a] + e.hi[a]) / 2);
+			cmax[a] = std::max(cmax[a], (e.lo[a] + e.hi[a]) / 2);
+		}
+	}
+	for (int a = 0; a < 3; a++) {
+		nodes[self].lo[a] = lo[a];
+		nodes[self].hi[a] = hi[a];
+	}
+	if (end - start <= 4) {
+		nodes[self].index = start;
+		nodes[self].count = end - start;
+		return;
+	}
+
+	int axis = 0;
+	for (int a = 1; a < 3; a++)
+		if (cmax[a] - cmin[a] > cmax[axis] - cmin[axis]) axis = a;
+	int mid = start + (end - start) / 2;
+	const std::vector<cluster_entry>& e = entries;
+	std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+		[&e, axis](int a, int b) { return e[a].lo[axis] + e[a].hi[axis] < e[b].lo[axis] + e[b].hi[axis]; });
+
+	nodes[self].count = 0;
+	build_node(order, start, mid);
+	nodes[self].index = static_cast<int>(nodes.size());
+	build_node(order, mid, end);
+}
+
+/*	Lists the clusters whose bounds the ray enters within [t_min, t_max],
+*	with the entry distance, in no particular order.
+*/
+void streamed_mesh::candidates(const ray& r, real t_min, real t_max,
+							   std::vector<std::pair<real, int> >& out) const {
+	out.clear();
+	if (nodes.empty())
+		return;
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const node& n = nodes[stack[--top]];
+		if (entry(n.lo, n.hi, r, t_min, t_max) == infinity)
+			continue;
+		if (n.count == 0) {
+			stack[top++] = n.index;
+			stack[top++] = static_cast<int>(&n - &nodes[0]) + 1;
+			continue;
+		}
+		for (int k = n.index; k < n.index + n.count; k++) {
+			int c = cluster_order[k];
+			real t = entry(entries[c].lo, entries[c].hi, r, t_min, t_max);
+			if (t != infinity)
+				out.push_back(std::make_pair(t, c));
+		}
+	}
+}
+
+/*	Returns cluster c, reading it from the file if it is not resident and
+*	evicting least recently used clusters until the budget holds again.
+*	The returned pointer keeps the cluster alive even if it is evicted
+*	while the caller still uses it.
+*/
+shared_ptr<compressed_mesh> streamed_mesh::acquire(int c) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (slots[c]) {
+		lru.splice(lru.begin(), lru, lru_pos[c]);
+		counters.reuses++;
+		return slots[c];
+	}
+
+	std::chrono::high_resolution_clock::time_point t = std::chrono::high_resolution_clock::now();
+	const cluster_entry& e = entries[c];
+	shared_ptr<compressed_mesh> m = compressed_mesh::deserialize(file.data() + e.offset, e.bytes);
+	if (!m) {
+		std::cerr << "cluster " << c << " is corrupt" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	// The copy is all that is needed; let the kernel reclaim the pages.
+	madvise(const_cast<char*>(file.data()) + e.offset, e.bytes, MADV_DONTNEED);
+
+	slots[c] = m;
+	lru.push_front(c);
+	lru_pos[c] = lru.begin();
+	resident_bytes += m->geometry_bytes() + m->bvh_bytes();
+	while (resident_bytes > budget && lru.back() != c) {
+		int old = lru.back();
+		lru.pop_back();
+		lru_pos[old] = lru.end();
+		resident_bytes -= slots[old]->geometry_bytes() + slots[old]->bvh_bytes();
+		slots[old].reset();
+		counters.evictions++;
+	}
+	counters.page_ins++;
+	counters.bytes_in += e.bytes;
+	counters.resident_peak = std::max(counters.resident_peak, resident_bytes);
+	counters.load_seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t).count();
+	return m;
+}
+
+/*	Intersects one resident cluster and turns its local triangle index into
+*	the global one.
+*/
+bool streamed_mesh::hit_mesh(int c, const compressed_mesh& m, const ray& r, real t_min, real t_max,
+							 hit_record& rec) const {
+	if (!m.hit(r, t_min, t_max, rec))
+		return false;
+	rec.obj = this;
+	rec.prim_id += entries[c].first_triangle;
+	return true;
+}
+
+bool streamed_mesh::hit_cluster(int c, const ray& r, real t_min, real t_max, hit_record& rec) const {
+	if (entry(entries[c].lo, entries[c].hi, r, t_min, t_max) == infinity)
+		return false;
+	shared_ptr<compressed_mesh> m = acquire(c);
+	return hit_mesh(c, *m, r, t_min, t_max, rec);
+}
+
+/*	Determines whether the ray hits the mesh, paging clusters in as needed.
+*	Clusters are visited by entry distance, so the ones behind the closest
+*	hit are never loaded.
+*	@r: ray to cast
+*	@t_min: the min t value
+*	@t_max: the max t value
+*	@rec: the hit record struct
+*	returns true if a triangle intersects the ray
+*/
+bool streamed_mesh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	std::vector<std::pair<real, int> > found;
+	candidates(r, t_min, t_max, found);
+	std::sort(found.begin(), found.end());
+
+	bool hit_anything = false;
+	for (size_t k = 0; k < found.size() && found[k].first < t_max; k++) {
+		int c = found[k].second;
+		shared_ptr<compressed_mesh> m = acquire(c);
+		if (hit_mesh(c, *m, r, t_min, t_max, rec)) {
+			t_max = rec.t;
+			hit_anything = true;
+		}
+	}
+	return hit_anything;
+}
+
+/*	Like hit(), but only the residency check happens under the lock: the
+*	resident clusters are copied out first, as acquire() does for hit(),
+*	and intersected after it is released.
+*/
+bool streamed_mesh::hit_resident(const ray& r, real t_min, real t_max, hit_record& rec,
+								 std::vector<std::pair<real, int> >& pending) const {
+	std::vector<std::pair<real, int> > found;
+	candidates(r, t_min, t_max, found);
+	std::sort(found.begin(), found.end());
+
+	std::vector<shared_ptr<compressed_mesh> > meshes(found.size());
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t k = 0; k < found.size(); k++)
+			meshes[k] = slots[found[k].second];
+	}
+
+	bool hit_anything = false;
+	for (size_t k = 0; k < found.size() && found[k].first < t_max; k++) {
+		int c = found[k].second;
+		if (!meshes[k]) {
+			pending.push_back(found[k]);
+		} else if (hit_mesh(c, *meshes[k], r, t_min, t_max, rec)) {
+			t_max = rec.t;
+			hit_anything = true;
+		}
+	}
+	return hit_anything;
+}
+
+/*	Computes the hit point and normal of the closest hit, paging its
+*	cluster back in if it was evicted since hit().
+*	@r: the ray that hit the mesh
+*	@rec: the hit record struct, rec.prim_id is the global triangle index
+*/
+void streamed_mesh::get_surface(const ray& r, hit_record& rec) const {
+	int c = 0, lo = 0, hi = static_cast<int>(entries.size()) - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (entries[mid].first_triangle <= static_cast<uint32_t>(rec.prim_id)) {
+			c = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	shared_ptr<compressed_mesh> m = acquire(c);
+	const int global = rec.prim_id;
+	rec.prim_id -= entries[c].first_triangle;
+	m->get_surface(r, rec);
+	rec.prim_id = global;
+}
+
+/*	Returns the bounds of all clusters.
+*	@time0: t0 time interval for moving objects
+*	@time1: t1 time interval for moving objects
+*	@output_box: output bounding box
+*	Returns false if the mesh has no clusters.
+*/
+bool streamed_mesh::bounding_box(double time0, double time1, aabb& output_box) const {
+	if (entries.empty())
+		return false;
+	vec3 lo(entries[0].lo[0], entries[0].lo[1], entries[0].lo[2]);
+	vec3 hi(entries[0].hi[0], entries[0].hi[1], entries[0].hi[2]);
+	for (size_t c = 1; c < entries.size(); c++)
+		for (int a = 0; a < 3; a++) {
+			lo[a] = std::min(lo[a], entries[c].lo[a]);
+			hi[a] = std::max(hi[a], entries[c].hi[a]);
+		}
+	output_box = aabb(lo, hi);
+	return true;
+}
+
+#endif
@@ -54,11 +54,7 @@ class checker_texture : public texture {
 		*	@p: point
 		*	retuns the texture value at p
 		*/
-        virtual vec3 value(double u, double v, const vec3& msn) const override {
-			vec3 p = vec3();
-			p[0] = msn[0];
-			p[1] = msn[1];
-			p[2] = msn[2];
+        virtual vec3 value(double u, double v, const vec3& p) const override {
             auto sines = sin(10*p.x())*sin(10*p.y())*sin(10*p.z());
             if (sines < 0)
                 return odd->value(u, v, p);
@@ -82,13 +78,9 @@ class noise_texture : public texture {
 		*	@p: point
 		*	retuns the texture value at p
 		*/
-        virtual vec3 value(double u, double v, const vec3& msn) const override {
+        virtual vec3 value(double u, double v, const vec3& p) const override {
             // return color(1,1,1)*0.5*(1 + noise.turb(scale * p));
             // return color(1,1,1)*noise.turb(scale * p);
-			vec3 p = vec3();
-			p[0] = msn[0];
-			p[1] = msn[1];
-			p[2] = msn[2];
             return vec3(1,1,1)*0.5*(1 + sin(scale*p.z() + 10*noise.turb(p)));
         }
 
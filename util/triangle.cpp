@@ -8,48 +8,56 @@
 *	@rec: The hit record to store the info
 *	returns true if ray intersects the triangle, false otherwise
 */
-bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-	double epsilon = 1e-5;
+bool triangle::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+	real epsilon = 1e-5;
 	vec3 edge1 = v2 - v1;
 	vec3 edge2 = v3 - v1;
-	vec3 n = cross(edge1,edge2);
 	vec3 h = cross(r.direction(),edge2);
-	double a = dot(edge1,h);
+	real a = dot(edge1,h);
 	if (a > -epsilon && a < epsilon) {
 		// ray is parallel to triangle
 		return false;
 	}
 
-	double f = 1.0/a;
+	real f = 1.0/a;
 	vec3 s = r.origin() - v1;
-	double u = f * dot(s,h);
+	real u = f * dot(s,h);
 	if (u < 0 || u > 1) {
 		return false;
 	}
 
 	vec3 q = cross(s,edge1);
-	double v = f * dot(r.direction(),q);
+	real v = f * dot(r.direction(),q);
 	if (v < 0 || u + v > 1) {
 		return false;
 	}
 
-	double t = f * dot(edge2,q);
+	real t = f * dot(edge2,q);
 	if (t < 0 || t < t_min || t_max < t) {
 		return false;
 	}
 	if (t > epsilon) {
 		rec.t = t;
-    	rec.p = r.at(rec.t);
-    	rec.n = normalize(n);
-		rec.kd = kd;
-		rec.ks = ks;
-		rec.mat_ptr = mat_ptr;
+		rec.obj = this;
+		rec.prim_id = 0;
+		rec.b1 = u;
+		rec.b2 = v;
+		rec.mat_id = mat_id;
 		return true;
 	}
 
 	return false;
 }
 
+/* Computes the hit point and geometric normal of the closest hit
+*	@r: Ray that hit the triangle
+*	@rec: The hit record to complete
+*/
+void triangle::get_surface(const ray& r, hit_record& rec) const {
+	rec.p = r.at(rec.t);
+	rec.n = normalize(cross(v2 - v1, v3 - v1));
+}
+
 /*	Constructs a bounding box for a triangle.
 *	@time0: t0 time interval for moving objects
 *	@time1: t1 time interval for moving objects
@@ -57,14 +65,14 @@ bool triangle::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
 *	Returns an AABB.
 */
 bool triangle::bounding_box(double time0, double time1, aabb& output_box) const {
-	double minx = fmin(v1[0],fmin(v2[0],v3[0]));
-	double miny = fmin(v1[1],fmin(v2[1],v3[1]));
-	double minz = fmin(v1[2],fmin(v2[2],v3[2]));
+	real minx = fmin(v1[0],fmin(v2[0],v3[0]));
+	real miny = fmin(v1[1],fmin(v2[1],v3[1]));
+	real minz = fmin(v1[2],fmin(v2[2],v3[2]));
 
-	double maxx = fmax(v1[0],fmax(v2[0],v3[0]));
-	double maxy = fmax(v1[1],fmax(v2[1],v3[1]));
-	double maxz = fmax(v1[2],fmax(v2[2],v3[2]));
-	double eps = 1e-5;
+	real maxx = fmax(v1[0],fmax(v2[0],v3[0]));
+	real maxy = fmax(v1[1],fmax(v2[1],v3[1]));
+	real maxz = fmax(v1[2],fmax(v2[2],v3[2]));
+	real eps = 1e-5;
 	
 	vec3 min = vec3(minx-eps,miny-eps,minz-eps);
 	vec3 max = vec3(maxx+eps,maxy+eps,maxz+eps);
@@ -7,11 +7,14 @@
 class triangle : public hittable {
     public:
         triangle() : kd(vec3(0,0,0)) {}
-        triangle(vec3 v1u, vec3 v2u, vec3 v3u, vec3 kdu, vec3 ksu, shared_ptr<material> m) : v1(v1u), v2(v2u), v3(v3u), kd(kdu), ks(ksu), mat_ptr(m) {};
+        triangle(vec3 v1u, vec3 v2u, vec3 v3u, vec3 kdu, vec3 ksu, int m) : v1(v1u), v2(v2u), v3(v3u), kd(kdu), ks(ksu), mat_id(m) {};
 
         virtual bool hit(
-            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+            const ray& r, real t_min, real t_max, hit_record& rec) const override;
 		virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+		virtual void get_surface(const ray& r, hit_record& rec) const override;
+		virtual vec3 phong_kd() const override { return kd; }
+		virtual vec3 phong_ks() const override { return ks; }
 
     public:
         vec3 v1;
@@ -19,7 +22,7 @@ class triangle : public hittable {
 		vec3 v3;
 		vec3 kd;
 		vec3 ks;
-		shared_ptr<material> mat_ptr;
+		int mat_id;
 };
 
 #endif
@@ -1,134 +1,17 @@
 #include "vec3.h"
 #include "util.h"
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
 using std::sqrt;
 
-/* Empty Constructor for vec3
-*/
-vec3::vec3() {
-	v[0] = 0;
-	v[1] = 0;
-	v[2] = 0;
-}
-
-/* Constructor for vec3
-	@v1: x component
-	@v2: y component
-	@v3: z component
-*/
-vec3::vec3(double v1, double v2, double v3) {
-	v[0] = v1;
-	v[1] = v2;
-	v[2] = v3;
-}
-
-/*vec3(vec3& v2) {
-	v[0] = v2[0];
-	v[1] = v2[1];
-	v[2] = v2[2];
-}*/
-
-/* Returns the x-component of the vector.
-*/
-double vec3::x() {
-	return v[0];
-}
-
-/* Returns the y-component of the vector.
-*/
-double vec3::y() {
-	return v[1];
-}
-
-/* Returns the z-component of the vector.
-*/
-double vec3::z() {
-	return v[2];
-}
-
-/* Returns the length of the vector (equlidian 2-norm).
-*/
-double vec3::length() {
-	return sqrt((v[0]*v[0]) + (v[1]*v[1]) + (v[2]*v[2]));
-}
-
-/* Returns the square of the length of the vector (euclidian 2-norm).
-*/
-double vec3::length_squared() {
-	return length()*length();
-}
-
-/* Returns a vector with all its components negated.
-*/
-vec3 vec3::operator-() const {
-	return vec3(-v[0],-v[1],-v[2]);
-}
-
-/* Used to return the ith element of v. 
-*/
-double vec3::operator[](int i) const {
-	return v[i];
-}
-
-/* Used to return the ith element of v. 
-*/
-double& vec3::operator[](int i) {
-	return v[i];
-}
-
-/* This operator does a component wise addition
-*	of v and v1.
-*	@v1: the vector whose components will be added to v
-*	returns: A reference to itself. 
-*/
-vec3& vec3::operator+=(const vec3 &v1) {
-	v[0] += v1.v[0];
-	v[1] += v1.v[1];
-	v[2] += v1.v[2];
-	return *this;
-}
-
-/* This operator does a scalar multiplication
-*	of v and t.
-*	@t: the scalar value.
-*	returns: A reference to itself. 
-*/
-vec3& vec3::operator*=(const double t) {
-	v[0] *= t;
-	v[1] *= t;
-	v[2] *= t;
-	return *this;
-}
-
-/* This operator does a scalar multiplication with v and
-*	the reciprocal of t.
-*	@v1: the scalar value.
-*	returns: A reference to itself. 
-*/
-vec3& vec3::operator/=(const double t) {
-	v[0] /= t;
-	v[1] /= t;
-	v[2] /= t;
-	return *this;
-}
-
-/* Returns true if all components of the vector
-*	are very small (close to 0)
-*/
-bool vec3::near_zero() const {
-        // Return true if the vector is close to zero in all dimensions.
-        const auto s = 1e-8; // 1e-8
-        return (fabs(v[0]) < s) && (fabs(v[1]) < s) && (fabs(v[2]) < s);
-}
-
 inline vec3 vec3::random() {
 	return vec3(random_double(), random_double(), random_double());
 }
 
-inline vec3 vec3::random(double min, double max) {
+inline vec3 vec3::random(real min, real max) {
 	return vec3(random_double(min,max), random_double(min,max), random_double(min,max));
 }
 
@@ -141,96 +24,6 @@ std::ostream& operator<<(std::ostream &out, const vec3 &v1) {
     return out << v1[0] << ' ' << v1[1] << ' ' << v1[2];
 }
 
-/* Performs a component-wise addition ofS two vectors.
-*	@u1: the first vector
-*	@u2: the second vector
-*	returns: A new vec3 whose components are the sum of 
-*	the components of u1 and u2.
-*/
-vec3 operator+(const vec3 &u1, const vec3 &u2) {
-    return vec3(u1[0] + u2[0], u1[1] + u2[1], u1[2] + u2[2]);
-}
-
-/* Performs a component-wise subtraction of two vectors.
-*	@u1: the first vector
-*	@u2: the second vector
-*	returns: A new vec3 whose components are the difference of 
-*	the components of u1 and u2.
-*/
-vec3 operator-(const vec3 &u1, const vec3 &u2) {
-    return vec3(u1[0] - u2[0], u1[1] - u2[1], u1[2] - u2[2]);
-}
-
-/* Performs a component-wise multiplication of two vec3 objects.
-*	@u1: the first vector
-*	@u2: the second vector
-*	returns: A new vec3 whose components are the product of 
-*	the components of u1 and u2.
-*/
-vec3 operator*(const vec3 &u1, const vec3 &u2) {
-    return vec3(u1[0] * u2[0], u1[1] * u2[1], u1[2] * u2[2]);
-}
-
-/* Performs a scalar multplication.
-*	@t: scalar value
-*	@v1: the vec3 to multiply with
-*	returns: A new vec3 whose components are multiplied
-*	by t
-*/
-vec3 operator*(double t, const vec3 &v1) {
-    return vec3(t*v1[0], t*v1[1], t*v1[2]);
-}
-
-/* Performs a scalar multplication.
-*	@v: the vec3 to multiply with
-*	@t: scalar value
-*	returns: A new vec3 whose components are multiplied
-*	by t.
-*/
-vec3 operator*(const vec3 &v, double t) {
-    return t * v;
-}
-
-/* Performs a scalar multplication.
-*	@v: the vec3 to multiply with
-*	@t: reciprocal of scalar value
-*	returns: A new vec3 whose components are multiplied
-*	by 1/t.
-*/
-vec3 operator/(vec3 v, double t) {
-    return (1/t) * v;
-}
-
-/* Performs a dot product
-*	@u1: First vec3
-*	@u2: Second vec3
-*	returns the dot product of u1 and u2.
-*/
-double dot(const vec3 &u1, const vec3 &u2) {
-    return u1[0] * u2[0]
-         + u1[1] * u2[1]
-         + u1[2] * u2[2];
-}
-
-/* Performs a cross product
-*	@u1: First vec3
-*	@u2: Second vec3
-*	returns the cross product of u1 and u2.
-*/
-vec3 cross(const vec3 &u1, const vec3 &u2) {
-    return vec3(u1[1] * u2[2] - u1[2] * u2[1],
-                u1[2] * u2[0] - u1[0] * u2[2],
-                u1[0] * u2[1] - u1[1] * u2[0]);
-}
-
-/* normalizes the vec3 v
-*	@v: Vec3 to normalize.
-*	returns the normalized vec3.
-*/
-vec3 normalize(vec3 v) {
-    return v / v.length();
-}
-
 /*	Translates the point
 *	@point: point to translate
 *	@dx: the amount in x
@@ -238,7 +31,7 @@ vec3 normalize(vec3 v) {
 *	@dz: the amount in z
 *	returns the translated vec3
 */
-vec3 translate(vec3 point, double dx, double dy, double dz) {
+vec3 translate(vec3 point, real dx, real dy, real dz) {
 	vec3 ret;
 	ret[0] = point[0] + dx;
 	ret[1] = point[1] + dy;
@@ -251,7 +44,7 @@ vec3 translate(vec3 point, double dx, double dy, double dz) {
 *	@d: amount in x,y,z
 *	returns the translated vec3
 */
-vec3 uniformTranslate(vec3 point, double d) {
+vec3 uniformTranslate(vec3 point, real d) {
 	vec3 ret;
 	ret[0] = point[0] + d;
 	ret[1] = point[1] + d;
@@ -266,7 +59,7 @@ vec3 uniformTranslate(vec3 point, double d) {
 *	@c: scale in z
 *	returns the scaled point
 */
-vec3 scale(vec3 point, double a, double b, double c) {
+vec3 scale(vec3 point, real a, real b, real c) {
 	vec3 ret;
 	ret[0] = point[0] * a;
 	ret[1] = point[1] * b;
@@ -279,7 +72,7 @@ vec3 scale(vec3 point, double a, double b, double c) {
 *	@s: the scale in x,y,z
 *	returns the scaled point
 */
-vec3 uniformScale(vec3 point, double s) {
+vec3 uniformScale(vec3 point, real s) {
 	vec3 ret;
 	ret[0] = point[0] * s;
 	ret[1] = point[1] * s;
@@ -292,12 +85,12 @@ vec3 uniformScale(vec3 point, double s) {
 *	@theta: angle (in deg)
 *	returns the rotated point
 */
-vec3 rotateX(vec3 point, double theta) {
+vec3 rotateX(vec3 point, real theta) {
 	vec3 ret;
-	double x = point[0];
-	double y = point[1];
-	double z = point[2];
-	double angle = degToRad(theta);
+	real x = point[0];
+	real y = point[1];
+	real z = point[2];
+	real angle = degToRad(theta);
 	ret[0] = point[0];
 	ret[1] = (y*cos(angle)) - (z*sin(angle));
 	ret[2] = (y*sin(angle)) + (z*cos(angle));
@@ -309,12 +102,12 @@ vec3 rotateX(vec3 point, double theta) {
 *	@theta: angle (in deg)
 *	returns the rotated point
 */
-vec3 rotateY(vec3 point, double theta) {
+vec3 rotateY(vec3 point, real theta) {
 	vec3 ret;
-	double x = point[0];
-	double y = point[1];
-	double z = point[2];
-	double angle = degToRad(theta);
+	real x = point[0];
+	real y = point[1];
+	real z = point[2];
+	real angle = degToRad(theta);
 	ret[0] = (x*cos(angle)) + (z*sin(angle));
 	ret[1] = point[1];
 	ret[2] = ((-x)*sin(angle)) + (z*cos(angle));
@@ -326,12 +119,12 @@ vec3 rotateY(vec3 point, double theta) {
 *	@theta: angle (in deg)
 *	returns the rotated point
 */
-vec3 rotateZ(vec3 point, double theta) {
+vec3 rotateZ(vec3 point, real theta) {
 	vec3 ret;
-	double x = point[0];
-	double y = point[1];
-	double z = point[2];
-	double angle = degToRad(theta);
+	real x = point[0];
+	real y = point[1];
+	real z = point[2];
+	real angle = degToRad(theta);
 	ret[0] = (x*cos(angle)) - (y*sin(angle));
 	ret[1] = ((x)*sin(angle)) + (y*cos(angle));
 	ret[2] = point[2];
@@ -344,10 +137,10 @@ vec3 rotateZ(vec3 point, double theta) {
 *	@axis: axis to rotate (1=X, 2=Y, 3=Z)
 *	returns the rotated point
 */
-vec3 rotate(vec3 point, double theta, int axis) {
-	double x = point[0];
-	double y = point[1];
-	double z = point[2];
+vec3 rotate(vec3 point, real theta, int axis) {
+	real x = point[0];
+	real y = point[1];
+	real z = point[2];
 	if (axis == 0) return rotateX(point, theta);
 	else if (axis == 1) return rotateY(point, theta);
 	if (axis > 2) std::cout << "Invalid axis in rotate, calling rotateZ" << std::endl;
@@ -361,10 +154,10 @@ vec3 rotate(vec3 point, double theta, int axis) {
 *	@axis: axis to rotate (1=X, 2=Y, 3=Z)
 *	returns the rotated point
 */
-vec3 rotateAboutPoint(vec3 point, double theta, int axis) {
-	double x = point[0];
-	double y = point[1];
-	double z = point[2];
+vec3 rotateAboutPoint(vec3 point, real theta, int axis) {
+	real x = point[0];
+	real y = point[1];
+	real z = point[2];
 	vec3 ret = translate(point, -x, -y, -z);
 	if (axis == 0) ret = rotateX(ret, theta);
 	else if (axis == 1) ret = rotateY(ret, theta);	
@@ -375,28 +168,6 @@ vec3 rotateAboutPoint(vec3 point, double theta, int axis) {
 	return ret;
 }
 
-/* Returns the reflected vector of v about normal n
-*	@v: vector to reflect
-*	@n: the normal of the surface
-*	returns the reflected vector of v
-*/
-vec3 reflect(const vec3& v, const vec3& n) {
-    return v - 2*dot(v,n)*n;
-}
-
-/*	Returns the refracted vector of uc about normal n
-*	@uv: vector to refract
-*	@n: normal of the surface
-*	@etai_over_etat: refractive index
-*	returns the partially refracted-reflected vector
-*/
-vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
-    auto cos_theta = fmin(dot(-uv, n), 1.0);
-    vec3 r_out_perp =  etai_over_etat * (uv + cos_theta*n);
-    vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
-    return r_out_perp + r_out_parallel;
-}
-
 /*	Returns a vector with random x,y,z values between (0,1]
 *	returns a vec3 with random x,y,z
 */
@@ -409,39 +180,101 @@ vec3 randomVec() {
 *	@max: The max value (exclusive)
 *	returns a vec3 with random x,y,z between [min,max)
 */
-vec3 randomVec(double min, double max) {
+vec3 randomVec(real min, real max) {
         return vec3(random_double(min,max), random_double(min,max), random_double(min,max));
 }
 
+/*	Maps a point of the unit square onto the unit disk with Shirley and
+*	Chiu's concentric mapping, which keeps areas (so it is uniform) and
+*	distorts little.
+*	@u1, @u2: uniform numbers in [0,1)
+*	returns a point (x, y, 0) with x^2 + y^2 <= 1, density 1 / pi
+*/
+inline vec3 sample_disk(real u1, real u2) {
+	real a = 2 * u1 - 1;
+	real b = 2 * u2 - 1;
+	if (a == 0 && b == 0)
+		return vec3(0, 0, 0);
+	real r, phi;
+	if (a * a > b * b) {
+		r = a;
+		phi = (pi / 4) * (b / a);
+	} else {
+		r = b;
+		phi = (pi / 2) - (pi / 4) * (a / b);
+	}
+	return vec3(r * std::cos(phi), r * std::sin(phi), 0);
+}
+
+/*	Cosine-weighted direction in the hemisphere around +z: a point of the
+*	concentric disk lifted onto the hemisphere (Malley's method).
+*	@u1, @u2: uniform numbers in [0,1)
+*	returns a unit vector, density cosine_hemisphere_pdf(z)
+*/
+inline vec3 sample_cosine_hemisphere(real u1, real u2) {
+	vec3 d = sample_disk(u1, u2);
+	real z = std::sqrt(std::max(real(0), 1 - d.x() * d.x() - d.y() * d.y()));
+	return vec3(d.x(), d.y(), z);
+}
+
+inline real cosine_hemisphere_pdf(real cos_theta) {
+	return cos_theta > 0 ? cos_theta / pi : 0;
+}
+
+/*	Uniform direction on the unit sphere.
+*	@u1, @u2: uniform numbers in [0,1)
+*	returns a unit vector, density 1 / (4 pi)
+*/
+inline vec3 sample_sphere(real u1, real u2) {
+	real z = 1 - 2 * u1;
+	real r = std::sqrt(std::max(real(0), 1 - z * z));
+	real phi = 2 * pi * u2;
+	return vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+inline real sphere_pdf() {
+	return 1 / (4 * pi);
+}
+
+/*	Uniform direction in the cone around +z with half-angle theta_max.
+*	@u1, @u2: uniform numbers in [0,1)
+*	@one_minus_cos_max: 1 - cos(theta_max), passed as such so small cones
+*	keep their precision
+*	returns a unit vector, density cone_pdf(one_minus_cos_max)
+*/
+inline vec3 sample_cone(real u1, real u2, real one_minus_cos_max) {
+	real cos_theta = 1 - u1 * one_minus_cos_max;
+	real sin_theta = std::sqrt(std::max(real(0), 1 - cos_theta * cos_theta));
+	real phi = 2 * pi * u2;
+	return vec3(std::cos(phi) * sin_theta, std::sin(phi) * sin_theta, cos_theta);
+}
+
+inline real cone_pdf(real one_minus_cos_max) {
+	return 1 / (2 * pi * one_minus_cos_max);
+}
+
 /*	Gets a random vector inside a unit disk
 *	returns a vec3
 */
 inline vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
-        if (p.length_squared() >= 1) continue;
-        return p;
-    }
+	return sample_disk(random_double(), random_double());
 }
 
-/*	Gets a random vector inside a unit sphere
+/*	Gets a random vector inside a unit sphere: a uniform direction scaled
+*	by the cube root of a uniform number, so the volume is covered evenly
 *	returns a vec3
 */
 vec3 random_in_unit_sphere() {
-    while (true) {
-        auto p = randomVec(-1,1);
-        if (p.length_squared() >= 1) continue;
-        return p;
-    }
+	vec3 d = sample_sphere(random_double(), random_double());
+	return std::cbrt(random_double()) * d;
 }
 
-/* Gets the normalized random vector inside a unit sphere
+/* Gets a uniformly distributed unit vector
 *	returns a vec3
 */
 vec3 random_unit_vector() {
-	return normalize(random_in_unit_sphere());
+	return sample_sphere(random_double(), random_double());
 }
-
 /* Gets the random vector that is in the same hemisphere as normal
 *	@normal: normal to compare
 *	returns a vec3
@@ -1,58 +1,236 @@
 #ifndef VEC3_H
 #define VEC3_H
+
+#include <cmath>
+#include <iostream>
+
+// Scalar precision used by vec3, ray, the hit record and all of the
+// intersection/traversal code. Compile with -DSINGLE_PRECISION to trace
+// in float, which halves the size of every vector and box.
+#ifdef SINGLE_PRECISION
+typedef float real;
+#else
+typedef double real;
+#endif
+
+// All of the arithmetic below is defined inline (and constexpr where C++11
+// allows it) so every hot-path vector operation can be inlined and
+// vectorized at the call site.
 class vec3 {
 	private:
-		double v[3];
+		real v[3];
 
 	public:
-		vec3();
-		vec3(double v1, double v2, double v3);
-		//vec3(vec3& v2);
-		double x();
-		double y();
-		double z();
-		double length();
-		double length_squared();
-		
-		vec3 operator-() const;
-        double operator[](int i) const;
-        double& operator[](int i);
-
-        vec3& operator+=(const vec3 &v1);
-        vec3& operator*=(const double t);
-        vec3& operator/=(const double t);
-
-		bool near_zero() const;
+		/* Empty Constructor for vec3
+		*/
+		constexpr vec3() : v{0, 0, 0} {}
+
+		/* Constructor for vec3
+		*	@v1: x component
+		*	@v2: y component
+		*	@v3: z component
+		*/
+		constexpr vec3(real v1, real v2, real v3) : v{v1, v2, v3} {}
+
+		/* Returns the x, y and z components of the vector.
+		*/
+		constexpr real x() const { return v[0]; }
+		constexpr real y() const { return v[1]; }
+		constexpr real z() const { return v[2]; }
+
+		/* Returns the square of the length of the vector (euclidian 2-norm).
+		*/
+		constexpr real length_squared() const {
+			return (v[0]*v[0]) + (v[1]*v[1]) + (v[2]*v[2]);
+		}
+
+		/* Returns the length of the vector (equlidian 2-norm).
+		*/
+		real length() const {
+			return std::sqrt(length_squared());
+		}
+
+		/* Returns a vector with all its components negated.
+		*/
+		constexpr vec3 operator-() const {
+			return vec3(-v[0], -v[1], -v[2]);
+		}
+
+		/* Used to return the ith element of v.
+		*/
+		constexpr real operator[](int i) const { return v[i]; }
+		real& operator[](int i) { return v[i]; }
+
+		/* This operator does a component wise addition
+		*	of v and v1.
+		*	@v1: the vector whose components will be added to v
+		*	returns: A reference to itself.
+		*/
+		vec3& operator+=(const vec3 &v1) {
+			v[0] += v1.v[0];
+			v[1] += v1.v[1];
+			v[2] += v1.v[2];
+			return *this;
+		}
+
+		/* This operator does a scalar multiplication
+		*	of v and t.
+		*	@t: the scalar value.
+		*	returns: A reference to itself.
+		*/
+		vec3& operator*=(const real t) {
+			v[0] *= t;
+			v[1] *= t;
+			v[2] *= t;
+			return *this;
+		}
+
+		/* This operator does a scalar multiplication with v and
+		*	the reciprocal of t.
+		*	@t: the scalar value.
+		*	returns: A reference to itself.
+		*/
+		vec3& operator/=(const real t) {
+			return *this *= 1/t;
+		}
+
+		/* Returns true if all components of the vector
+		*	are very small (close to 0)
+		*/
+		bool near_zero() const {
+			const real s = 1e-8;
+			return (std::fabs(v[0]) < s) && (std::fabs(v[1]) < s) && (std::fabs(v[2]) < s);
+		}
+
 		inline static vec3 random();
-		inline static vec3 random(double min, double max);
+		inline static vec3 random(real min, real max);
 };
 
+/* Performs a component-wise addition of two vectors.
+*	@u1: the first vector
+*	@u2: the second vector
+*	returns: A new vec3 whose components are the sum of
+*	the components of u1 and u2.
+*/
+constexpr vec3 operator+(const vec3 &u1, const vec3 &u2) {
+	return vec3(u1[0] + u2[0], u1[1] + u2[1], u1[2] + u2[2]);
+}
+
+/* Performs a component-wise subtraction of two vectors.
+*	@u1: the first vector
+*	@u2: the second vector
+*	returns: A new vec3 whose components are the difference of
+*	the components of u1 and u2.
+*/
+constexpr vec3 operator-(const vec3 &u1, const vec3 &u2) {
+	return vec3(u1[0] - u2[0], u1[1] - u2[1], u1[2] - u2[2]);
+}
+
+/* Performs a component-wise multiplication of two vec3 objects.
+*	@u1: the first vector
+*	@u2: the second vector
+*	returns: A new vec3 whose components are the product of
+*	the components of u1 and u2.
+*/
+constexpr vec3 operator*(const vec3 &u1, const vec3 &u2) {
+	return vec3(u1[0] * u2[0], u1[1] * u2[1], u1[2] * u2[2]);
+}
+
+/* Performs a scalar multplication.
+*	@t: scalar value
+*	@v1: the vec3 to multiply with
+*	returns: A new vec3 whose components are multiplied
+*	by t
+*/
+constexpr vec3 operator*(real t, const vec3 &v1) {
+	return vec3(t*v1[0], t*v1[1], t*v1[2]);
+}
+
+constexpr vec3 operator*(const vec3 &v, real t) {
+	return t * v;
+}
+
+/* Performs a scalar multplication.
+*	@v: the vec3 to multiply with
+*	@t: reciprocal of scalar value
+*	returns: A new vec3 whose components are multiplied
+*	by 1/t.
+*/
+constexpr vec3 operator/(const vec3 &v, real t) {
+	return (1/t) * v;
+}
+
+/* Performs a dot product
+*	@u1: First vec3
+*	@u2: Second vec3
+*	returns the dot product of u1 and u2.
+*/
+constexpr real dot(const vec3 &u1, const vec3 &u2) {
+	return u1[0] * u2[0]
+		 + u1[1] * u2[1]
+		 + u1[2] * u2[2];
+}
+
+/* Performs a cross product
+*	@u1: First vec3
+*	@u2: Second vec3
+*	returns the cross product of u1 and u2.
+*/
+constexpr vec3 cross(const vec3 &u1, const vec3 &u2) {
+	return vec3(u1[1] * u2[2] - u1[2] * u2[1],
+				u1[2] * u2[0] - u1[0] * u2[2],
+				u1[0] * u2[1] - u1[1] * u2[0]);
+}
+
+/* normalizes the vec3 v
+*	@v: Vec3 to normalize.
+*	returns the normalized vec3.
+*/
+inline vec3 normalize(const vec3 &v) {
+	return v / v.length();
+}
+
+/* Returns the reflected vector of v about normal n
+*	@v: vector to reflect
+*	@n: the normal of the surface
+*	returns the reflected vector of v
+*/
+constexpr vec3 reflect(const vec3& v, const vec3& n) {
+	return v - 2*dot(v,n)*n;
+}
+
+/*	Returns the refracted vector of uc about normal n
+*	@uv: vector to refract
+*	@n: normal of the surface
+*	@etai_over_etat: refractive index
+*	returns the partially refracted-reflected vector
+*/
+inline vec3 refract(const vec3& uv, const vec3& n, real etai_over_etat) {
+	real cos_theta = std::fmin(dot(-uv, n), real(1));
+	vec3 r_out_perp =  etai_over_etat * (uv + cos_theta*n);
+	vec3 r_out_parallel = -std::sqrt(std::fabs(1 - r_out_perp.length_squared())) * n;
+	return r_out_perp + r_out_parallel;
+}
+
 std::ostream& operator<<(std::ostream &out, const vec3 &v1);
-vec3 operator+(const vec3 &u1, const vec3 &u2);
-vec3 operator-(const vec3 &u1, const vec3 &u2);
-vec3 operator*(const vec3 &u1, const vec3 &u2);
-vec3 operator*(double t, const vec3 &v1);
-vec3 operator*(const vec3 &v, double t);
-vec3 operator/(vec3 v, double t);
-double dot(const vec3 &u1, const vec3 &u2);
-vec3 cross(const vec3 &u1, const vec3 &u2);
-vec3 normalize(vec3 v);
 
 // Affine transformations
-vec3 translate(vec3 point, double dx, double dy, double dz);
-vec3 uniformTranslate(vec3 point, double d);
-vec3 scale(vec3 point, double a, double b, double c);
-vec3 uniformScale(vec3 point, double s);
-vec3 rotateX(vec3 point, double theta);
-vec3 rotateY(vec3 point, double theta);
-vec3 rotateZ(vec3 point, double theta);
-vec3 rotate(vec3 point, double theta, int axis);
-vec3 rotateAboutPoint(vec3 point, double theta, int axis);
-vec3 reflect(const vec3& v, const vec3& n);
-vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat);
+vec3 translate(vec3 point, real dx, real dy, real dz);
+vec3 uniformTranslate(vec3 point, real d);
+vec3 scale(vec3 point, real a, real b, real c);
+vec3 uniformScale(vec3 point, real s);
+vec3 rotateX(vec3 point, real theta);
+vec3 rotateY(vec3 point, real theta);
+vec3 rotateZ(vec3 point, real theta);
+vec3 rotate(vec3 point, real theta, int axis);
+vec3 rotateAboutPoint(vec3 point, real theta, int axis);
 vec3 randomVec();
-vec3 randomVec(double min, double max);
+vec3 randomVec(real min, real max);
 vec3 random_in_unit_sphere();
 vec3 random_unit_vector();
 inline vec3 random_in_unit_disk();
+inline vec3 sample_disk(real u1, real u2);
+inline vec3 sample_cosine_hemisphere(real u1, real u2);
+inline vec3 sample_sphere(real u1, real u2);
+inline vec3 sample_cone(real u1, real u2, real one_minus_cos_max);
 #endif
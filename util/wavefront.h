@@ -0,0 +1,610 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <stdint.h>
+
+#include "util.h"
+#include "hittable.h"
+#include "material.h"
+#include "perf_counter.h"
+#include "framebuffer.h"
+#include "streamed_mesh.h"
+#include "light_list.h"
+#include "sampler.h"
+#include "denoise.h"
+
+// Number of paths (pixel samples) in flight at once in wavefront mode.
+#ifndef WAVEFRONT_BATCH
+#define WAVEFRONT_BATCH (1 << 18)
+#endif
+
+/*	A queue of path segments stored as structure of arrays. Every entry is
+*	one path: its current ray, the throughput it has gathered so far, the
+*	pixel it contributes to, which sample of that pixel it is and the
+*	density with which the ray was scattered (0 for camera rays and
+*	specular bounces).
+*/
+struct ray_queue {
+	std::vector<real> ox, oy, oz;
+	std::vector<real> dx, dy, dz;
+	std::vector<real> wr, wg, wb;
+	std::vector<int> pixel;
+	std::vector<int> sample;
+	std::vector<real> pdf;
+
+	size_t size() const { return pixel.size(); }
+	bool empty() const { return pixel.empty(); }
+
+	void clear() {
+		ox.clear(); oy.clear(); oz.clear();
+		dx.clear(); dy.clear(); dz.clear();
+		wr.clear(); wg.clear(); wb.clear();
+		pixel.clear();
+		sample.clear();
+		pdf.clear();
+	}
+
+	void reserve(size_t n) {
+		ox.reserve(n); oy.reserve(n); oz.reserve(n);
+		dx.reserve(n); dy.reserve(n); dz.reserve(n);
+		wr.reserve(n); wg.reserve(n); wb.reserve(n);
+		pixel.reserve(n);
+		sample.reserve(n);
+		pdf.reserve(n);
+	}
+
+	/*	Appends a path segment
+	*	@r: the ray to trace
+	*	@weight: throughput of the path up to this ray
+	*	@pix: index of the pixel the path belongs to
+	*	@smp: which sample of the pixel the path is
+	*	@scatter_pdf: density with which r was scattered, 0 if none
+	*/
+	void push(const ray& r, const vec3& weight, int pix, int smp, real scatter_pdf = 0) {
+		vec3 o = r.origin();
+		vec3 d = r.direction();
+		ox.push_back(o[0]); oy.push_back(o[1]); oz.push_back(o[2]);
+		dx.push_back(d[0]); dy.push_back(d[1]); dz.push_back(d[2]);
+		wr.push_back(weight[0]); wg.push_back(weight[1]); wb.push_back(weight[2]);
+		pixel.push_back(pix);
+		sample.push_back(smp);
+		pdf.push_back(scatter_pdf);
+	}
+
+	ray get_ray(size_t i) const {
+		return ray(vec3(ox[i], oy[i], oz[i]), vec3(dx[i], dy[i], dz[i]));
+	}
+
+	vec3 weight(size_t i) const {
+		return vec3(wr[i], wg[i], wb[i]);
+	}
+};
+
+/*	Wall-clock time spent in each wavefront stage, in seconds.
+*/
+struct wavefront_stats {
+	double generate = 0;
+	double reorder = 0;
+	double extend = 0;
+	double sort = 0;
+	double shade = 0;
+	double connect = 0;
+	double accumulate = 0;
+	unsigned long rays = 0;
+	unsigned long shadow_rays = 0;
+	unsigned long deferred = 0;		// ray visits put off until a cluster was paged in
+	unsigned long dropped = 0;		// deferred visits a closer hit made unnecessary
+	long long extend_misses = 0;
+	bool misses_available = false;
+
+	/*	Prints the per-stage times
+	*	@out: the stream to print to
+	*/
+	void print(std::ostream& out) const {
+		double total = generate + reorder + extend + sort + shade + connect + accumulate;
+		out << "wavefront stages (ms):"
+			<< " generate " << generate * 1000
+			<< " reorder " << reorder * 1000
+			<< " extend " << extend * 1000
+			<< " sort " << sort * 1000
+			<< " shade " << shade * 1000
+			<< " connect " << connect * 1000
+			<< " accumulate " << accumulate * 1000
+			<< " | total " << total * 1000
+			<< " | " << rays << " rays + " << shadow_rays << " shadow rays, "
+			<< (total > 0 ? (rays + shadow_rays) / total / 1e6 : 0) << " Mrays/s\n";
+		if (deferred)
+			out << "streamed geometry: " << deferred << " deferred cluster visits, " << dropped
+				<< " dropped behind a closer hit\n";
+		out << "extend cache misses: ";
+		if (misses_available)
+			out << extend_misses << " (" << (rays ? double(extend_misses) / rays : 0) << " per ray)\n";
+		else
+			out << "n/a (perf_event_open unavailable)\n";
+	}
+};
+
+/*	Wavefront path tracer. Instead of following one path at a time through
+*	ray_color, a whole batch of paths advances one bounce per iteration and
+*	every step runs as a separate pass over the batch:
+*		generate:   camera rays for the next batch of pixel samples
+*		reorder:    optional, bin secondary rays by origin cell and direction
+*		extend:     closest hit for every ray in the queue
+*		sort:       order the hits by material (misses first)
+*		shade:      emission, scattering, next-bounce queue, shadow rays
+*		connect:    trace the shadow rays, add the light they reach
+*		accumulate: add the finished contributions to the image
+*	The result matches ray_color; with a sampler (use_sampler) every path
+*	even uses the same numbers.
+*/
+class wavefront_integrator {
+	public:
+		/*	@world: the scene
+		*	@materials: the scene's material table
+		*	@background: color of rays that miss everything
+		*	@max_depth: max number of rays per path, as in ray_color
+		*/
+		wavefront_integrator(const hittable& world, const material_table& materials,
+							 const vec3& background, int max_depth)
+			:
+#ifdef WAVEFRONT_SORT
+			  sort_rays(true),
+#else
+			  sort_rays(false),
+#endif
+			  world(world), materials(materials), background(background), max_depth(max_depth),
+			  streamed(nullptr), lights(nullptr), samples(nullptr), features(nullptr),
+			  first_path(0), image_pixels(0)
+		{}
+
+		/*	Turns on next-event estimation: every diffuse hit also sends a
+		*	shadow ray to a point sampled on one of the lights, weighted
+		*	against the scattered ray with multiple importance sampling.
+		*	@list: the scene's lights, or null to only scatter
+		*/
+		void sample_lights(const light_list* list) { lights = list; }
+
+		/*	Adds a streamed mesh to the scene. It must not also be in world:
+		*	extend() traces it itself, so that rays waiting for the same
+		*	cluster are handled together once it is paged in.
+		*	@mesh: the mesh, or null for none
+		*/
+		void stream(const streamed_mesh* mesh) { streamed = mesh; }
+
+		/*	Takes the pixel, lens and bounce numbers of every path from a
+		*	sampler, the same dimensions ray_color uses.
+		*	@s: the sampler, or null for random_double()
+		*/
+		void use_sampler(const sampler* s) { samples = s; }
+
+		/*	Records what every camera path saw (see record_hit), summed per
+		*	pixel like the image, for the denoiser.
+		*	@buffers: sized like the image, or null for none
+		*/
+		void capture_features(feature_buffers* buffers) { features = buffers; }
+
+		template <typename camera_t>
+		void render(const camera_t& cam, int width, int height, int samples_per_pixel,
+					framebuffer& image);
+
+	public:
+		wavefront_stats stats;
+
+		// Reorder secondary rays before each extend pass (-DWAVEFRONT_SORT).
+		bool sort_rays;
+
+	private:
+		typedef std::chrono::high_resolution_clock clock;
+
+		void reorder(ray_queue& q);
+		template <typename T>
+		void gather(const std::vector<T>& src, std::vector<T>& dst) const {
+			dst.resize(order.size());
+			for (size_t k = 0; k < order.size(); k++)
+				dst[k] = src[order[k]];
+		}
+		void trace(const ray_queue& q, std::vector<hit_record>& out, std::vector<unsigned char>& hit);
+		void extend(const ray_queue& q);
+		void sort_by_material(const ray_queue& q);
+		void shade(const ray_queue& q, ray_queue& next, int depth);
+		void connect();
+		void accumulate(const ray_queue& q, framebuffer& image);
+
+		static double seconds_since(clock::time_point start) {
+			return std::chrono::duration<double>(clock::now() - start).count();
+		}
+
+		const hittable& world;
+		const material_table& materials;
+		vec3 background;
+		int max_depth;
+		const streamed_mesh* streamed;
+		const light_list* lights;
+		const sampler* samples;
+		feature_buffers* features;
+		// Features of the paths of the current batch, by path index
+		// (sample * pixels + pixel - first_path), and whether each path is
+		// still on its specular chain, and the color each path has
+		// gathered so far.
+		std::vector<pixel_features> seen;
+		std::vector<unsigned char> seeing;
+		std::vector<vec3> gathered;
+		long first_path;
+		long image_pixels;
+		// Per cluster of the streamed mesh, the queue entries waiting for it
+		// with their entry distance, and the clusters that have any, with
+		// the nearest of those distances.
+		std::vector<std::vector<std::pair<real, int> > > waiting;
+		std::vector<std::pair<real, int> > pending;
+		std::vector<std::pair<real, int> > busy;
+
+		// Per-entry results of the current bounce, indexed like the queue.
+		std::vector<hit_record> hits;
+		std::vector<unsigned char> found;
+		std::vector<vec3> contrib;
+		// Shadow rays of the current bounce: the weight is the contribution
+		// if the ray reaches light (times its emission), path is the entry
+		// of the queue it belongs to.
+		ray_queue shadow;
+		std::vector<const hittable*> shadow_light;
+		std::vector<int> shadow_path;
+		std::vector<hit_record> shadow_hits;
+		std::vector<unsigned char> shadow_found;
+		// Queue indices sorted by material, and the bucket counts used for it.
+		std::vector<int> order;
+		std::vector<int> bucket;
+		// Scratch space for reorder.
+		std::vector<uint32_t> keys, keys_tmp;
+		std::vector<int> order_tmp;
+		ray_queue sorted;
+
+		cache_miss_counter counter;
+};
+
+/*	Renders the image. Paths are generated WAVEFRONT_BATCH at a time and
+*	each batch is traced to completion before the next one is generated.
+*	@cam: the camera, anything with get_ray(u, v, lens_u1, lens_u2)
+*	@width: image width
+*	@height: image height
+*	@samples_per_pixel: samples per pixel
+*	@image: receives the summed (not yet averaged) color of every pixel,
+*	pixel (i, j) at j*width + i
+*/
+template <typename camera_t>
+void wavefront_integrator::render(const camera_t& cam, int width, int height,
+								  int samples_per_pixel, framebuffer& image) {
+	const long pixels = long(width) * height;
+	const long paths = pixels * samples_per_pixel;
+	image.reset(width, height);
+
+	ray_queue current, next;
+	current.reserve(WAVEFRONT_BATCH);
+	next.reserve(WAVEFRONT_BATCH);
+
+	for (long first = 0; first < paths; first += WAVEFRONT_BATCH) {
+		long last = std::min(paths, first + long(WAVEFRONT_BATCH));
+		first_path = first;
+		image_pixels = pixels;
+		if (features) {
+			seen.assign(last - first, pixel_features());
+			seeing.assign(last - first, 1);
+			gathered.assign(last - first, vec3(0,0,0));
+		}
+
+		clock::time_point t = clock::now();
+		current.clear();
+		for (long k = first; k < last; k++) {
+			int pix = static_cast<int>(k % pixels);
+			int smp = static_cast<int>(k / pixels);
+			int i = pix % width;
+			int j = pix / width;
+			if (samples) {
+				auto u = (i + samples->get(pix, smp, SAMPLE_PIXEL)) / (width-1);
+				auto v = (j + samples->get(pix, smp, SAMPLE_PIXEL + 1)) / (height-1);
+				current.push(cam.get_ray(u, v, samples->get(pix, smp, SAMPLE_LENS),
+										 samples->get(pix, smp, SAMPLE_LENS + 1)), vec3(1,1,1), pix, smp);
+			} else {
+				auto u = (i + random_double()) / (width-1);
+				auto v = (j + random_double()) / (height-1);
+				current.push(cam.get_ray(u, v), vec3(1,1,1), pix, smp);
+			}
+		}
+		stats.generate += seconds_since(t);
+
+		for (int depth = 0; depth < max_depth && !current.empty(); depth++) {
+			// Camera rays are already coherent, only scattered rays are sorted.
+			if (sort_rays && depth > 0)
+				reorder(current);
+			extend(current);
+			sort_by_material(current);
+			shade(current, next, depth);
+			connect();
+			accumulate(current, image);
+			std::swap(current, next);
+		}
+
+		if (features) {
+			for (long k = first; k < last; k++)
+				features->add(static_cast<size_t>(k % pixels), seen[k - first], gathered[k - first]);
+		}
+	}
+
+	stats.misses_available = counter.available();
+	stats.extend_misses = counter.misses();
+}
+
+/*	Spreads the low 9 bits of x out to every third bit.
+*/
+inline uint32_t morton_spread(uint32_t x) {
+	x &= 0x1FF;
+	x = (x | (x << 16)) & 0x030000FF;
+	x = (x | (x << 8)) & 0x0300F00F;
+	x = (x | (x << 4)) & 0x030C30C3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+/*	Sorts the queue so rays that start close together and point the same
+*	way are traced one after another and share BVH nodes in the cache. The
+*	key is the direction octant (3 bits) above a 27-bit Morton code of the
+*	origin quantized to a 512^3 grid over the queue's bounds, sorted with a
+*	three-pass 10-bit radix sort.
+*	@q: the queue, reordered in place
+*/
+void wavefront_integrator::reorder(ray_queue& q) {
+	clock::time_point t = clock::now();
+	size_t n = q.size();
+
+	real lo[3] = { q.ox[0], q.oy[0], q.oz[0] };
+	real hi[3] = { q.ox[0], q.oy[0], q.oz[0] };
+	for (size_t i = 1; i < n; i++) {
+		lo[0] = std::min(lo[0], q.ox[i]); hi[0] = std::max(hi[0], q.ox[i]);
+		lo[1] = std::min(lo[1], q.oy[i]); hi[1] = std::max(hi[1], q.oy[i]);
+		lo[2] = std::min(lo[2], q.oz[i]); hi[2] = std::max(hi[2], q.oz[i]);
+	}
+	real scale[3];
+	for (int a = 0; a < 3; a++)
+		scale[a] = hi[a] > lo[a] ? real(511.99) / (hi[a] - lo[a]) : 0;
+
+	keys.resize(n);
+	keys_tmp.resize(n);
+	order.resize(n);
+	order_tmp.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		uint32_t x = static_cast<uint32_t>((q.ox[i] - lo[0]) * scale[0]);
+		uint32_t y = static_cast<uint32_t>((q.oy[i] - lo[1]) * scale[1]);
+		uint32_t z = static_cast<uint32_t>((q.oz[i] - lo[2]) * scale[2]);
+		uint32_t octant = (q.dx[i] < 0) | ((q.dy[i] < 0) << 1) | ((q.dz[i] < 0) << 2);
+		keys[i] = (octant << 27) | (morton_spread(x) << 2) | (morton_spread(y) << 1) | morton_spread(z);
+		order[i] = static_cast<int>(i);
+	}
+
+	for (int shift = 0; shift < 30; shift += 10) {
+		bucket.assign(1025, 0);
+		for (size_t i = 0; i < n; i++)
+			bucket[((keys[i] >> shift) & 1023) + 1]++;
+		for (size_t b = 1; b < bucket.size(); b++)
+			bucket[b] += bucket[b-1];
+		for (size_t i = 0; i < n; i++) {
+			int dst = bucket[(keys[i] >> shift) & 1023]++;
+			keys_tmp[dst] = keys[i];
+			order_tmp[dst] = order[i];
+		}
+		keys.swap(keys_tmp);
+		order.swap(order_tmp);
+	}
+
+	// Gather one array at a time, each pass only touches two arrays.
+	gather(q.ox, sorted.ox); gather(q.oy, sorted.oy); gather(q.oz, sorted.oz);
+	gather(q.dx, sorted.dx); gather(q.dy, sorted.dy); gather(q.dz, sorted.dz);
+	gather(q.wr, sorted.wr); gather(q.wg, sorted.wg); gather(q.wb, sorted.wb);
+	gather(q.pixel, sorted.pixel);
+	gather(q.sample, sorted.sample);
+	gather(q.pdf, sorted.pdf);
+	std::swap(q, sorted);
+	stats.reorder += seconds_since(t);
+}
+
+/*	Finds the closest hit of every ray in a queue and expands its surface.
+*	With a streamed mesh, rays first test its resident clusters and are
+*	queued on the ones that are not; each queue then runs in one go, so a
+*	cluster is paged in at most once per pass however many rays need it.
+*	The queues run nearest first, by the closest entry distance of their
+*	rays, and a ray is only tested if it enters the cluster before its
+*	closest hit so far; a cluster no ray still needs is not paged in.
+*	@q: the rays to trace
+*	@out: receives the closest hit of every ray
+*	@hit: receives whether each ray hit anything
+*/
+void wavefront_integrator::trace(const ray_queue& q, std::vector<hit_record>& out,
+								 std::vector<unsigned char>& hit) {
+	size_t n = q.size();
+	out.resize(n);
+	hit.resize(n);
+	if (streamed)
+		waiting.resize(streamed->clusters());
+	for (size_t i = 0; i < n; i++) {
+		ray r = q.get_ray(i);
+		hit[i] = world.hit(r, 0.001, infinity, out[i]);
+		if (streamed) {
+			pending.clear();
+			if (streamed->hit_resident(r, 0.001, hit[i] ? out[i].t : infinity, out[i], pending))
+				hit[i] = true;
+			for (size_t k = 0; k < pending.size(); k++) {
+				std::vector<std::pair<real, int> >& w = waiting[pending[k].second];
+				if (w.empty())
+					busy.push_back(std::make_pair(pending[k].first, pending[k].second));
+				w.push_back(std::make_pair(pending[k].first, static_cast<int>(i)));
+			}
+			stats.deferred += pending.size();
+		}
+		if (hit[i])
+			out[i].obj->get_surface(r, out[i]);
+	}
+	if (!streamed)
+		return;
+
+	for (size_t b = 0; b < busy.size(); b++) {
+		const std::vector<std::pair<real, int> >& w = waiting[busy[b].second];
+		for (size_t k = 0; k < w.size(); k++)
+			busy[b].first = std::min(busy[b].first, w[k].first);
+	}
+	std::sort(busy.begin(), busy.end());
+	for (size_t b = 0; b < busy.size(); b++) {
+		int c = busy[b].second;
+		for (size_t k = 0; k < waiting[c].size(); k++) {
+			int i = waiting[c][k].second;
+			if (hit[i] && waiting[c][k].first >= out[i].t) {
+				stats.dropped++;
+				continue;
+			}
+			ray r = q.get_ray(i);
+			hit_record rec;
+			if (streamed->hit_cluster(c, r, 0.001, hit[i] ? out[i].t : infinity, rec)) {
+				streamed->get_surface(r, rec);
+				out[i] = rec;
+				hit[i] = true;
+			}
+		}
+		waiting[c].clear();
+	}
+	busy.clear();
+}
+
+/*	Finds the closest hit of every path's ray.
+*	@q: the rays to trace
+*/
+void wavefront_integrator::extend(const ray_queue& q) {
+	clock::time_point t = clock::now();
+	counter.start();
+	trace(q, hits, found);
+	counter.stop();
+	stats.rays += q.size();
+	stats.extend += seconds_since(t);
+}
+
+/*	Counting sort of the queue indices by material ID. Misses go in bucket 0
+*	so shading walks one material at a time.
+*	@q: the rays of the current bounce
+*/
+void wavefront_integrator::sort_by_material(const ray_queue& q) {
+	clock::time_point t = clock::now();
+	size_t n = q.size();
+	bucket.assign(materials.size() + 2, 0);
+	for (size_t i = 0; i < n; i++)
+		bucket[(found[i] ? hits[i].mat_id + 1 : 0) + 1]++;
+	for (size_t b = 1; b < bucket.size(); b++)
+		bucket[b] += bucket[b-1];
+	order.resize(n);
+	for (size_t i = 0; i < n; i++)
+		order[bucket[found[i] ? hits[i].mat_id + 1 : 0]++] = static_cast<int>(i);
+	stats.sort += seconds_since(t);
+}
+
+/*	Shades every hit in material order: records the emitted (or background)
+*	radiance weighted by the path throughput, and queues the scattered ray.
+*	With lights, diffuse hits also queue a shadow ray to a sampled light,
+*	and light reached by a diffuse bounce is weighted against the chance
+*	that the shadow ray would have found it, as in ray_color.
+*	@q: the rays of the current bounce
+*	@next: receives the rays of the next bounce
+*	@depth: the bounce, which picks the sampler dimensions
+*/
+void wavefront_integrator::shade(const ray_queue& q, ray_queue& next, int depth) {
+	clock::time_point t = clock::now();
+	next.clear();
+	shadow.clear();
+	shadow_light.clear();
+	shadow_path.clear();
+	contrib.resize(q.size());
+	for (size_t k = 0; k < order.size(); k++) {
+		int i = order[k];
+		vec3 weight = q.weight(i);
+		if (!found[i]) {
+			contrib[i] = weight * background;
+			long path = long(q.sample[i]) * image_pixels + q.pixel[i] - first_path;
+			if (features && seeing[path]) {
+				record_miss(seen[path]);
+				seeing[path] = 0;
+			}
+			continue;
+		}
+
+		const hit_record& rec = hits[i];
+		const material& mat = materials[rec.mat_id];
+		ray r = q.get_ray(i);
+		long path = long(q.sample[i]) * image_pixels + q.pixel[i] - first_path;
+		if (features && seeing[path])
+			seeing[path] = record_hit(seen[path], mat, rec, rec.t * r.direction().length());
+		contrib[i] = weight * emitted(mat, rec.u, rec.v, rec.p);
+		if (lights && q.pdf[i] > 0 && mat.type == DIFFUSE_LIGHT)
+			contrib[i] *= power_heuristic(q.pdf[i], lights->pdf(rec.obj, r.origin(), r.direction()));
+
+		sample_stream st(samples, q.pixel[i], q.sample[i], depth);
+		st.next_bounce();
+		ray scattered;
+		vec3 attenuation;
+		if (!scatter(mat, r, rec, attenuation, scattered, st.get(BOUNCE_DIRECTION),
+					 st.get(BOUNCE_DIRECTION + 1), st.get(BOUNCE_CHOICE)))
+			continue;
+		next.push(scattered, weight * attenuation, q.pixel[i], q.sample[i],
+				  lights ? scatter_pdf(mat, rec, scattered) : 0);
+
+		if (!lights || mat.type != LAMBERTIAN)
+			continue;
+		vec3 dir;
+		real light_pdf;
+		const hittable* light = lights->sample(rec.p, st.get(BOUNCE_LIGHT), st.get(BOUNCE_LIGHT_POINT),
+											   st.get(BOUNCE_LIGHT_POINT + 1), dir, light_pdf);
+		if (!light)
+			continue;
+		vec3 wi = normalize(dir);
+		real bsdf_pdf = dot(rec.n, wi) / pi;
+		if (bsdf_pdf <= 0)
+			continue;
+		shadow.push(ray(offset_ray_origin(rec.p, rec.n, wi), wi),
+					weight * attenuation * (bsdf_pdf * power_heuristic(light_pdf, bsdf_pdf) / light_pdf),
+					q.pixel[i], q.sample[i]);
+		shadow_light.push_back(light);
+		shadow_path.push_back(i);
+	}
+	stats.shade += seconds_since(t);
+}
+
+/*	Traces the shadow rays queued by shade and adds the emission of those
+*	whose closest hit is the light they were sent to.
+*/
+void wavefront_integrator::connect() {
+	if (shadow.empty())
+		return;
+	clock::time_point t = clock::now();
+	trace(shadow, shadow_hits, shadow_found);
+	for (size_t k = 0; k < shadow.size(); k++) {
+		const hit_record& rec = shadow_hits[k];
+		if (shadow_found[k] && rec.obj == shadow_light[k])
+			contrib[shadow_path[k]] += shadow.weight(k) * emitted(materials[rec.mat_id], rec.u, rec.v, rec.p);
+	}
+	stats.shadow_rays += shadow.size();
+	stats.connect += seconds_since(t);
+}
+
+/*	Adds this bounce's contributions to their pixels.
+*	@q: the rays of the current bounce
+*	@image: the accumulation buffer
+*/
+void wavefront_integrator::accumulate(const ray_queue& q, framebuffer& image) {
+	clock::time_point t = clock::now();
+	for (size_t i = 0; i < q.size(); i++)
+		image.add(q.pixel[i], contrib[i]);
+	if (features) {
+		for (size_t i = 0; i < q.size(); i++)
+			gathered[long(q.sample[i]) * image_pixels + q.pixel[i] - first_path] += contrib[i];
+	}
+	stats.accumulate += seconds_since(t);
+}
+
+#endif